@@ -0,0 +1,416 @@
+/**
+ * @file bench-csim.c
+ * @brief Measures the throughput of the cache engine csim is built on
+ *
+ * Every synthetic trace of BENCH_TRACES runs through every geometry of
+ * BENCH_GEOMETRIES, each run in a child process of its own so its peak
+ * resident set size can be told apart. Only the time spent in cache_run()
+ * is measured, not generating the accesses. Each run is repeated and the
+ * fastest repetition is kept.
+ *
+ * The results can be written as CSV, and compared with a CSV of an earlier
+ * version: a run whose throughput dropped by more than the threshold, or
+ * whose statistics changed, is reported and makes the exit status 1.
+ */
+
+#define _DEFAULT_SOURCE /* for wait4 */
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "cachelab.h"
+#include "synth.h"
+
+/** @brief Accesses generated at a time, then run through the cache */
+#define BENCH_BATCH 4096
+
+/** @brief -q divides the length of every trace by this */
+#define QUICK_DIVISOR 16
+
+#define LINE_SIZE 512
+#define MAX_ROWS 256
+
+#define MIB (1UL << 20)
+
+/** @brief First byte of every working set */
+#define BENCH_BASE 0x10000000UL
+
+typedef struct {
+    const char *name;
+    synth_config_t config;
+    long accesses;
+} bench_trace_t;
+
+typedef struct {
+    const char *name;
+    int s;
+    int E;
+    int b;
+} bench_geometry_t;
+
+/** @brief The traces, the transposes are one pass over the matrix */
+static const bench_trace_t BENCH_TRACES[] = {
+    {"sequential",
+     {.pattern = SYNTH_STRIDE, .base = BENCH_BASE, .span = 64 * MIB,
+      .stride = 8, .sizes = {8}, .size_count = 1, .store_percent = 30,
+      .seed = 1},
+     16L << 20},
+    {"strided",
+     {.pattern = SYNTH_STRIDE, .base = BENCH_BASE, .span = 64 * MIB,
+      .stride = 4160, .sizes = {8}, .size_count = 1, .store_percent = 30,
+      .seed = 2},
+     8L << 20},
+    {"random",
+     {.pattern = SYNTH_RANDOM, .base = BENCH_BASE, .span = 64 * MIB,
+      .sizes = {8}, .size_count = 1, .store_percent = 30, .seed = 3},
+     8L << 20},
+    {"transpose1024",
+     {.pattern = SYNTH_TRANSPOSE, .base = BENCH_BASE, .n = 1024},
+     2L * 1024 * 1024},
+    {"transpose4096",
+     {.pattern = SYNTH_TRANSPOSE, .base = BENCH_BASE, .n = 4096},
+     2L * 4096 * 4096},
+};
+
+/** @brief 32 KiB caches of 64-byte blocks, direct mapped to fully
+ * associative */
+static const bench_geometry_t BENCH_GEOMETRIES[] = {
+    {"E1", 9, 1, 6},   {"E4", 7, 4, 6},    {"E16", 5, 16, 6},
+    {"E64", 3, 64, 6}, {"full", 0, 512, 6},
+};
+
+#define TRACE_COUNT (int)(sizeof(BENCH_TRACES) / sizeof(BENCH_TRACES[0]))
+#define GEOMETRY_COUNT                                                        \
+    (int)(sizeof(BENCH_GEOMETRIES) / sizeof(BENCH_GEOMETRIES[0]))
+
+/**
+ * @brief What one run measured
+ */
+typedef struct {
+    char trace[32];
+    char geometry[32];
+    long accesses;
+    double seconds;
+    long peak_rss_kib;
+    csim_stats_t stats;
+} bench_row_t;
+
+/* Globals set on the command line */
+static const char *kernel = "auto";
+static const char *policy = "lru";
+
+/*
+ * usage - Prints usage info
+ */
+static void usage(char *argv[]) {
+    printf("Usage: %s [-hq] [-n <reps>] [-k <kernel>] [-p <policy>] "
+           "[-o <csv>] [-c <csv>] [-r <percent>]\n",
+           argv[0]);
+    printf("Options:\n");
+    printf("  -h            Print this help message.\n");
+    printf("  -q            Run traces %d times shorter.\n", QUICK_DIVISOR);
+    printf("  -n <reps>     Repeat every run, keep the fastest (default 3).\n");
+    printf("  -k <kernel>   Tag-compare kernel (default auto).\n");
+    printf("  -p <policy>   Replacement policy (default lru).\n");
+    printf("  -o <csv>      Write the results to <csv>.\n");
+    printf("  -c <csv>      Compare with the results of an earlier run.\n");
+    printf("  -r <percent>  Slowdown -c reports (default 10).\n");
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ * @brief Body of the child process of a run: simulate the trace and write
+ * the time and statistics to fd
+ */
+static int run_child(const bench_trace_t *trace,
+                     const bench_geometry_t *geometry, long accesses,
+                     int fd) {
+    cache_t cache;
+    if (!cache_init(&cache, geometry->s, geometry->E, geometry->b, kernel,
+                    policy))
+        return 1;
+
+    static trace_access_t batch[BENCH_BATCH];
+    synth_t gen;
+    if (!synth_init(&gen, &trace->config))
+        return 1;
+    double seconds = 0;
+    for (long done = 0; done < accesses; done += BENCH_BATCH) {
+        int count = accesses - done < BENCH_BATCH ? (int)(accesses - done)
+                                                  : BENCH_BATCH;
+        synth_fill(&gen, batch, count);
+        double start = now_seconds();
+        cache_run(&cache, &cache.stats, batch, count);
+        seconds = seconds + (now_seconds() - start);
+    }
+
+    bench_row_t row;
+    memset(&row, 0, sizeof(row));
+    row.seconds = seconds;
+    row.stats = cache.stats;
+    cache_free(&cache);
+    return write(fd, &row, sizeof(row)) == sizeof(row) ? 0 : 1;
+}
+
+/**
+ * @brief Run trace through geometry in a child process into *row
+ */
+static bool run_once(const bench_trace_t *trace,
+                     const bench_geometry_t *geometry, long accesses,
+                     bench_row_t *row) {
+    int fds[2];
+    if (pipe(fds) < 0) {
+        fprintf(stderr, "Error creating a pipe: %s\n", strerror(errno));
+        return false;
+    }
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        _exit(run_child(trace, geometry, accesses, fds[1]));
+    }
+    close(fds[1]);
+    if (pid < 0) {
+        fprintf(stderr, "Error forking: %s\n", strerror(errno));
+        close(fds[0]);
+        return false;
+    }
+
+    bool read_all = read(fds[0], row, sizeof(*row)) == sizeof(*row);
+    close(fds[0]);
+    int status;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) < 0 || !WIFEXITED(status) ||
+        WEXITSTATUS(status) != 0 || !read_all) {
+        fprintf(stderr, "Error running %s on %s\n", trace->name,
+                geometry->name);
+        return false;
+    }
+    row->peak_rss_kib = usage.ru_maxrss;
+    return true;
+}
+
+/**
+ * @brief Run trace through geometry reps times, keeping the fastest run
+ * and the largest peak RSS
+ */
+static bool run_bench(const bench_trace_t *trace,
+                      const bench_geometry_t *geometry, long accesses,
+                      int reps, bench_row_t *row) {
+    long peak_rss_kib = 0;
+    for (int i = 0; i < reps; i++) {
+        bench_row_t run;
+        if (!run_once(trace, geometry, accesses, &run))
+            return false;
+        if (i == 0 || run.seconds < row->seconds)
+            *row = run;
+        if (run.peak_rss_kib > peak_rss_kib)
+            peak_rss_kib = run.peak_rss_kib;
+    }
+    row->peak_rss_kib = peak_rss_kib;
+    snprintf(row->trace, sizeof(row->trace), "%s", trace->name);
+    snprintf(row->geometry, sizeof(row->geometry), "%s", geometry->name);
+    row->accesses = accesses;
+    return true;
+}
+
+static double per_second(const bench_row_t *row) {
+    return row->seconds > 0 ? row->accesses / row->seconds : 0;
+}
+
+static bool write_csv(const char *file_name, const bench_row_t *rows,
+                      int count) {
+    FILE *fp = fopen(file_name, "w");
+    if (fp == NULL) {
+        fprintf(stderr, "Error creating %s: %s\n", file_name, strerror(errno));
+        return false;
+    }
+    fprintf(fp, "trace,geometry,accesses,seconds,accesses_per_sec,"
+                "ns_per_access,peak_rss_kib,hits,misses,evictions\n");
+    for (int i = 0; i < count; i++) {
+        const bench_row_t *row = &rows[i];
+        fprintf(fp, "%s,%s,%ld,%.6f,%.0f,%.3f,%ld,%ld,%ld,%ld\n", row->trace,
+                row->geometry, row->accesses, row->seconds, per_second(row),
+                row->seconds * 1e9 / row->accesses, row->peak_rss_kib,
+                row->stats.hits, row->stats.misses, row->stats.evictions);
+    }
+    if (fclose(fp) != 0) {
+        fprintf(stderr, "Error writing %s\n", file_name);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Read the rows of a CSV write_csv() wrote into rows, at most max
+ * of them. Return how many there were, or -1 on error.
+ */
+static int read_csv(const char *file_name, bench_row_t *rows, int max) {
+    FILE *fp = fopen(file_name, "r");
+    if (fp == NULL) {
+        fprintf(stderr, "Error opening %s: %s\n", file_name, strerror(errno));
+        return -1;
+    }
+
+    char line[LINE_SIZE];
+    int count = 0;
+    bool header = true;
+    while (fgets(line, sizeof(line), fp) && count < max) {
+        if (header) {
+            header = false;
+            continue;
+        }
+        bench_row_t *row = &rows[count];
+        memset(row, 0, sizeof(*row));
+        double rate, ns;
+        if (sscanf(line, "%31[^,],%31[^,],%ld,%lf,%lf,%lf,%ld,%ld,%ld,%ld",
+                   row->trace, row->geometry, &row->accesses, &row->seconds,
+                   &rate, &ns, &row->peak_rss_kib, &row->stats.hits,
+                   &row->stats.misses, &row->stats.evictions) != 10) {
+            fprintf(stderr, "%s: invalid line: %s", file_name, line);
+            fclose(fp);
+            return -1;
+        }
+        count = count + 1;
+    }
+    fclose(fp);
+    return count;
+}
+
+/**
+ * @brief Report the rows that got slower than baseline by more than
+ * threshold percent or changed their statistics. Return how many did.
+ */
+static int compare(const bench_row_t *rows, int count,
+                   const bench_row_t *baseline, int baseline_count,
+                   double threshold) {
+    int regressions = 0;
+    for (int i = 0; i < count; i++) {
+        const bench_row_t *row = &rows[i];
+        const bench_row_t *old = NULL;
+        for (int j = 0; j < baseline_count && old == NULL; j++) {
+            if (strcmp(baseline[j].trace, row->trace) == 0 &&
+                strcmp(baseline[j].geometry, row->geometry) == 0 &&
+                baseline[j].accesses == row->accesses)
+                old = &baseline[j];
+        }
+        if (old == NULL)
+            continue;
+
+        if (old->stats.hits != row->stats.hits ||
+            old->stats.misses != row->stats.misses ||
+            old->stats.evictions != row->stats.evictions) {
+            printf("CHANGED %s %s: hits:%ld misses:%ld evictions:%ld, "
+                   "was hits:%ld misses:%ld evictions:%ld\n",
+                   row->trace, row->geometry, row->stats.hits,
+                   row->stats.misses, row->stats.evictions, old->stats.hits,
+                   old->stats.misses, old->stats.evictions);
+            regressions = regressions + 1;
+        }
+
+        double change = (per_second(row) / per_second(old) - 1) * 100;
+        if (change < -threshold) {
+            printf("SLOWER %s %s: %.1f%% (%.0f vs %.0f accesses/s)\n",
+                   row->trace, row->geometry, change, per_second(row),
+                   per_second(old));
+            regressions = regressions + 1;
+        }
+    }
+    return regressions;
+}
+
+int main(int argc, char *argv[]) {
+    bool quick = false;
+    int reps = 3;
+    const char *output_file = NULL;
+    const char *baseline_file = NULL;
+    double threshold = 10;
+
+    int c;
+    while ((c = getopt(argc, argv, "hqn:k:p:o:c:r:")) != -1) {
+        switch (c) {
+        case 'q':
+            quick = true;
+            break;
+        case 'n':
+            reps = atoi(optarg);
+            if (reps < 1) {
+                printf("Error: -n needs at least one repetition\n");
+                exit(1);
+            }
+            break;
+        case 'k':
+            kernel = optarg;
+            break;
+        case 'p':
+            policy = optarg;
+            break;
+        case 'o':
+            output_file = optarg;
+            break;
+        case 'c':
+            baseline_file = optarg;
+            break;
+        case 'r':
+            threshold = atof(optarg);
+            break;
+        case 'h':
+            usage(argv);
+            exit(0);
+        default:
+            usage(argv);
+            exit(1);
+        }
+    }
+
+    static bench_row_t rows[MAX_ROWS];
+    int count = 0;
+    printf("%-14s %-9s %10s %14s %10s %12s\n", "trace", "geometry",
+           "accesses", "accesses/s", "ns/access", "peak RSS KiB");
+    for (int t = 0; t < TRACE_COUNT; t++) {
+        const bench_trace_t *trace = &BENCH_TRACES[t];
+        long accesses =
+            quick ? trace->accesses / QUICK_DIVISOR : trace->accesses;
+        for (int g = 0; g < GEOMETRY_COUNT; g++) {
+            bench_row_t *row = &rows[count];
+            if (!run_bench(trace, &BENCH_GEOMETRIES[g], accesses, reps, row))
+                exit(1);
+            printf("%-14s %-9s %10ld %14.0f %10.2f %12ld\n", row->trace,
+                   row->geometry, row->accesses, per_second(row),
+                   row->seconds * 1e9 / row->accesses, row->peak_rss_kib);
+            count = count + 1;
+        }
+    }
+
+    if (output_file && !write_csv(output_file, rows, count))
+        exit(1);
+    if (baseline_file) {
+        static bench_row_t baseline[MAX_ROWS];
+        int baseline_count = read_csv(baseline_file, baseline, MAX_ROWS);
+        if (baseline_count < 0)
+            exit(1);
+        int regressions =
+            compare(rows, count, baseline, baseline_count, threshold);
+        printf("%d regression%s against %s\n", regressions,
+               regressions == 1 ? "" : "s", baseline_file);
+        if (regressions > 0)
+            return 1;
+    }
+    return 0;
+}
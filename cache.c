@@ -0,0 +1,1225 @@
+/**
+ * @file cache.c
+ * @brief Set-associative cache engine shared by the csim front ends
+ */
+
+#define _DEFAULT_SOURCE /* for MAP_ANONYMOUS and MADV_HUGEPAGE */
+
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "cache.h"
+
+/** @brief Marks the end of a recency list and a free hash slot */
+#define NO_WAY -1
+
+/** @brief Sets with at least this many ways index their tags with a hash */
+#define HASH_MIN_ASSOC 64
+#define HASH_MULTIPLIER 0x9E3779B97F4A7C15UL
+
+/** @brief Sets with at least this many ways compare tags with a vector */
+#define SIMD_MIN_ASSOC 4
+
+/** @brief Every array of a cache starts on a hardware cache line */
+#define ARRAY_ALIGN 64
+
+/** @brief Line storage of at least this many bytes goes on huge pages */
+#define HUGE_PAGE_SIZE (2UL << 20)
+
+/** @brief First bytes of a snapshot file and its format version */
+#define SNAPSHOT_MAGIC "CSIMSNAP"
+#define SNAPSHOT_VERSION 1
+
+/** @brief Largest re-reference prediction value of 2-bit RRIP */
+#define RRPV_MAX 3
+
+/** @brief BRRIP inserts a line as SRRIP does once in this many fills */
+#define BRRIP_EPSILON 32
+
+/** @brief Seed of RANDOM and BRRIP when the policy name has none */
+#define DEFAULT_SEED 1
+
+/** @brief Policy names in cache_policy_t order */
+static const char *policy_names[] = {"lru",   "fifo",  "plru",
+                                     "srrip", "brrip", "random"};
+
+/**
+ * @brief Reference kernel, also the fastest choice for small associativity
+ */
+static int scan_scalar(const long *tags, const unsigned char *valid_bits,
+                       int count, long tag) {
+    for (int i = 0; i < count; i++) {
+        if (tags[i] == tag && valid_bits[i])
+            return i;
+    }
+    return NO_WAY;
+}
+
+/**
+ * @brief Return the lowest way of a chunk starting at way base whose bit is
+ * set in the hit mask and whose line is valid.
+ */
+static inline int first_valid(unsigned mask, const unsigned char *valid_bits,
+                              int base) {
+    while (mask) {
+        int way = base + __builtin_ctz(mask);
+        if (valid_bits[way])
+            return way;
+        mask &= mask - 1;
+    }
+    return NO_WAY;
+}
+
+#if defined(__x86_64__)
+/*
+ * The vector kernels load whole chunks, so the last chunk of a set may read
+ * tags past count. The tags array is followed by the rest of the cache
+ * block, so those loads stay inside the allocation; the extra lanes are
+ * masked off before they can match.
+ */
+
+static int scan_sse2(const long *tags, const unsigned char *valid_bits,
+                     int count, long tag) {
+    __m128i key = _mm_set1_epi64x(tag);
+    for (int i = 0; i < count; i += 2) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(tags + i));
+        // SSE2 has no 64-bit compare, so both 32-bit halves must match
+        __m128i eq = _mm_cmpeq_epi32(v, key);
+        eq = _mm_and_si128(eq, _mm_shuffle_epi32(eq, _MM_SHUFFLE(2, 3, 0, 1)));
+        unsigned mask = _mm_movemask_pd(_mm_castsi128_pd(eq));
+        if (count - i < 2)
+            mask &= (1u << (count - i)) - 1;
+        int way = first_valid(mask, valid_bits, i);
+        if (way != NO_WAY)
+            return way;
+    }
+    return NO_WAY;
+}
+
+__attribute__((target("avx2"))) static int
+scan_avx2(const long *tags, const unsigned char *valid_bits, int count,
+          long tag) {
+    __m256i key = _mm256_set1_epi64x(tag);
+    for (int i = 0; i < count; i += 4) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(tags + i));
+        __m256i eq = _mm256_cmpeq_epi64(v, key);
+        unsigned mask = _mm256_movemask_pd(_mm256_castsi256_pd(eq));
+        if (count - i < 4)
+            mask &= (1u << (count - i)) - 1;
+        int way = first_valid(mask, valid_bits, i);
+        if (way != NO_WAY)
+            return way;
+    }
+    return NO_WAY;
+}
+
+__attribute__((target("avx512f"))) static int
+scan_avx512(const long *tags, const unsigned char *valid_bits, int count,
+            long tag) {
+    __m512i key = _mm512_set1_epi64(tag);
+    for (int i = 0; i < count; i += 8) {
+        // masked load, so no lanes past count are read at all
+        __mmask8 lanes = count - i < 8 ? (1u << (count - i)) - 1 : 0xff;
+        __m512i v = _mm512_maskz_loadu_epi64(lanes, tags + i);
+        unsigned mask = _mm512_mask_cmpeq_epi64_mask(lanes, v, key);
+        int way = first_valid(mask, valid_bits, i);
+        if (way != NO_WAY)
+            return way;
+    }
+    return NO_WAY;
+}
+#endif
+
+/**
+ * @brief Pick the tag-compare kernel by name, or by CPU features when name
+ * is "auto". Return NULL if the kernel is unknown or unsupported here.
+ */
+static cache_scan_fn_t select_scan_kernel(const char *name, int E) {
+    if (strcmp(name, "scalar") == 0)
+        return scan_scalar;
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    bool has_avx2 = __builtin_cpu_supports("avx2");
+    bool has_avx512 = __builtin_cpu_supports("avx512f");
+
+    if (strcmp(name, "sse2") == 0)
+        return scan_sse2;
+    if (strcmp(name, "avx2") == 0 && has_avx2)
+        return scan_avx2;
+    if (strcmp(name, "avx512") == 0 && has_avx512)
+        return scan_avx512;
+    if (strcmp(name, "auto") == 0) {
+        // short sets are done before a vector would be loaded
+        if (E < SIMD_MIN_ASSOC)
+            return scan_scalar;
+        if (has_avx512 && E >= 8)
+            return scan_avx512;
+        if (has_avx2)
+            return scan_avx2;
+        return scan_sse2;
+    }
+#else
+    if (strcmp(name, "auto") == 0)
+        return scan_scalar;
+#endif
+    return NULL;
+}
+
+/**
+ * @brief Home slot of tag in a per-set table of 2^hash_bits slots
+ */
+static inline size_t hash_slot(const cache_t *cache, long tag) {
+    return ((unsigned long)tag * HASH_MULTIPLIER) >> (64 - cache->hash_bits);
+}
+
+/**
+ * @brief Look up the way holding tag through the per-set hash index.
+ * Return NO_WAY when the tag is not cached.
+ */
+static int hash_find(const cache_t *cache, long set_num, long tag) {
+    const int *slots = cache->hash_slots + (set_num << cache->hash_bits);
+    const long *tags = cache->tags + set_num * cache->E;
+    size_t mask = ((size_t)1 << cache->hash_bits) - 1;
+
+    // an empty slot ends the probe sequence
+    for (size_t i = hash_slot(cache, tag);; i = (i + 1) & mask) {
+        int way = slots[i] - 1;
+        if (way == NO_WAY || tags[way] == tag)
+            return way;
+    }
+}
+
+/**
+ * @brief Record that tag now lives in way of this set.
+ */
+static void hash_insert(cache_t *cache, long set_num, long tag, int way) {
+    int *slots = cache->hash_slots + (set_num << cache->hash_bits);
+    size_t mask = ((size_t)1 << cache->hash_bits) - 1;
+
+    size_t i = hash_slot(cache, tag);
+    while (slots[i] != 0)
+        i = (i + 1) & mask;
+    slots[i] = way + 1;
+}
+
+/**
+ * @brief Drop tag from the hash index of this set.
+ */
+static void hash_remove(cache_t *cache, long set_num, long tag) {
+    int *slots = cache->hash_slots + (set_num << cache->hash_bits);
+    const long *tags = cache->tags + set_num * cache->E;
+    size_t mask = ((size_t)1 << cache->hash_bits) - 1;
+
+    size_t hole = hash_slot(cache, tag);
+    while (tags[slots[hole] - 1] != tag)
+        hole = (hole + 1) & mask;
+
+    // shift later entries of the probe run back so no tombstones are needed
+    for (size_t i = (hole + 1) & mask; slots[i] != 0; i = (i + 1) & mask) {
+        size_t home = hash_slot(cache, tags[slots[i] - 1]);
+        // move only if home is not cyclically within (hole, i]
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            slots[hole] = slots[i];
+            hole = i;
+        }
+    }
+    slots[hole] = 0;
+}
+
+/**
+ * @brief Initialize or update the line at index idx of the flat arrays
+ */
+static void init_line(cache_t *cache, long idx, long tag) {
+    cache->tags[idx] = tag;
+    cache->valid_bits[idx] = 1;
+    cache->dirty_bits[idx] = 0;
+}
+
+/**
+ * @brief Append a newly filled way to the most recently used end of its set.
+ */
+static inline void lru_insert(cache_t *cache, long set_num, int way) {
+    long base = set_num * cache->E;
+    int tail = cache->lru_tail[set_num];
+
+    cache->lru_next[base + way] = NO_WAY;
+    if (cache->line_count[set_num] == 1) {
+        // first line of this set
+        cache->lru_prev[base + way] = NO_WAY;
+        cache->lru_head[set_num] = way;
+    } else {
+        cache->lru_prev[base + way] = tail;
+        cache->lru_next[base + tail] = way;
+    }
+    cache->lru_tail[set_num] = way;
+}
+
+/**
+ * @brief Take a way out of the recency list of its set.
+ */
+static void lru_unlink(cache_t *cache, long set_num, int way) {
+    long base = set_num * cache->E;
+    int prev = cache->lru_prev[base + way];
+    int next = cache->lru_next[base + way];
+    if (prev == NO_WAY)
+        cache->lru_head[set_num] = next;
+    else
+        cache->lru_next[base + prev] = next;
+    if (next == NO_WAY)
+        cache->lru_tail[set_num] = prev;
+    else
+        cache->lru_prev[base + next] = prev;
+}
+
+/**
+ * @brief Move a way that was just accessed to the most recently used end.
+ */
+static inline void lru_promote(cache_t *cache, long set_num, int way) {
+    long base = set_num * cache->E;
+    if (cache->lru_tail[set_num] == way)
+        return;
+
+    lru_unlink(cache, set_num, way);
+
+    // append at the most recently used end
+    int tail = cache->lru_tail[set_num];
+    cache->lru_prev[base + way] = tail;
+    cache->lru_next[base + way] = NO_WAY;
+    cache->lru_next[base + tail] = way;
+    cache->lru_tail[set_num] = way;
+}
+
+/**
+ * @brief Next random number of set_num. It depends only on the seed, the set
+ * and how many numbers the set drew before, so every set has a reproducible
+ * stream whichever thread simulates it.
+ */
+static inline unsigned long draw(cache_t *cache, long set_num) {
+    unsigned long x = cache->seed ^ ((unsigned long)set_num << 32) ^
+                      cache->draws[set_num];
+    cache->draws[set_num] = cache->draws[set_num] + 1;
+
+    // splitmix64 finalizer
+    x = x + HASH_MULTIPLIER;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9UL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBUL;
+    return x ^ (x >> 31);
+}
+
+/**
+ * @brief Point the PLRU tree of set_num away from way.
+ *
+ * The E - 1 nodes of a set are stored heap-ordered at 1 .. E - 1 of its E
+ * repl_bits. Leaf E + w is way w, and a node holding 0 sends the victim
+ * search to its left child.
+ */
+static inline void plru_touch(cache_t *cache, long set_num, int way) {
+    unsigned char *tree = cache->repl_bits + set_num * cache->E;
+    for (int node = cache->E + way; node > 1; node /= 2)
+        tree[node / 2] = (node & 1) == 0;
+}
+
+static inline int plru_victim(const cache_t *cache, long set_num) {
+    const unsigned char *tree = cache->repl_bits + set_num * cache->E;
+    int node = 1;
+    while (node < cache->E)
+        node = 2 * node + tree[node];
+    return node - cache->E;
+}
+
+/**
+ * @brief First way predicted to be re-referenced furthest in the future.
+ *
+ * Ageing every line until one reaches RRPV_MAX is the same as adding the
+ * distance from the oldest line to RRPV_MAX once.
+ */
+static inline int rrip_victim(cache_t *cache, long set_num) {
+    unsigned char *rrpv = cache->repl_bits + set_num * cache->E;
+    int victim = 0;
+    for (int w = 1; w < cache->E; w++) {
+        if (rrpv[w] > rrpv[victim])
+            victim = w;
+    }
+    unsigned char age = RRPV_MAX - rrpv[victim];
+    if (age > 0) {
+        for (int w = 0; w < cache->E; w++)
+            rrpv[w] = rrpv[w] + age;
+    }
+    return victim;
+}
+
+/*
+ * The policy hooks below are always inlined with a constant policy into the
+ * per-policy access functions, so each of those keeps only its own case.
+ */
+
+/**
+ * @brief Way of the full set_num to evict
+ */
+static inline __attribute__((always_inline)) int
+repl_victim(cache_t *cache, long set_num, cache_policy_t policy) {
+    switch (policy) {
+    case CACHE_LRU:
+    case CACHE_FIFO:
+        return cache->lru_head[set_num];
+    case CACHE_PLRU:
+        return plru_victim(cache, set_num);
+    case CACHE_SRRIP:
+    case CACHE_BRRIP:
+        return rrip_victim(cache, set_num);
+    case CACHE_RANDOM:
+        break;
+    }
+    return draw(cache, set_num) % cache->E;
+}
+
+/**
+ * @brief Record that way of set_num was just filled, into a free way when
+ * cold is true and over a victim otherwise
+ */
+static inline __attribute__((always_inline)) void
+repl_fill(cache_t *cache, long set_num, int way, bool cold,
+          cache_policy_t policy) {
+    switch (policy) {
+    case CACHE_LRU:
+    case CACHE_FIFO:
+        if (cold)
+            lru_insert(cache, set_num, way);
+        else
+            lru_promote(cache, set_num, way);
+        break;
+    case CACHE_PLRU:
+        plru_touch(cache, set_num, way);
+        break;
+    case CACHE_SRRIP:
+    case CACHE_BRRIP: {
+        // BRRIP predicts a distant re-reference for most new lines
+        unsigned char rrpv = RRPV_MAX - 1;
+        if (policy == CACHE_BRRIP &&
+            draw(cache, set_num) % BRRIP_EPSILON != 0)
+            rrpv = RRPV_MAX;
+        cache->repl_bits[set_num * cache->E + way] = rrpv;
+        break;
+    }
+    case CACHE_RANDOM:
+        break;
+    }
+}
+
+/**
+ * @brief Record a hit on way of set_num
+ */
+static inline __attribute__((always_inline)) void
+repl_hit(cache_t *cache, long set_num, int way, cache_policy_t policy) {
+    switch (policy) {
+    case CACHE_LRU:
+        lru_promote(cache, set_num, way);
+        break;
+    case CACHE_PLRU:
+        plru_touch(cache, set_num, way);
+        break;
+    case CACHE_SRRIP:
+    case CACHE_BRRIP:
+        cache->repl_bits[set_num * cache->E + way] = 0;
+        break;
+    case CACHE_FIFO:
+    case CACHE_RANDOM:
+        break;
+    }
+}
+
+bool cache_parse_policy(const char *name, cache_policy_t *policy,
+                        unsigned long *seed) {
+    size_t len = strcspn(name, ":");
+    *seed = DEFAULT_SEED;
+    if (name[len] == ':') {
+        char *end;
+        *seed = strtoul(name + len + 1, &end, 0);
+        if (end == name + len + 1 || *end != '\0')
+            return false;
+    }
+
+    int count = sizeof(policy_names) / sizeof(policy_names[0]);
+    for (int i = 0; i < count; i++) {
+        if (strlen(policy_names[i]) == len &&
+            strncmp(name, policy_names[i], len) == 0) {
+            *policy = (cache_policy_t)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+static cache_run_fn_t select_run_kernel(const cache_t *cache,
+                                        const char *kernel);
+
+/**
+ * @brief Reserve bytes at the end of a block of *size bytes, starting on a
+ * ARRAY_ALIGN boundary, and return their offset
+ */
+static size_t carve(size_t *size, size_t bytes) {
+    size_t offset = *size;
+    *size = (offset + bytes + ARRAY_ALIGN - 1) & ~(size_t)(ARRAY_ALIGN - 1);
+    return offset;
+}
+
+/**
+ * @brief Get size zeroed bytes for cache->block.
+ *
+ * A large block is mapped on a huge-page boundary and advised onto huge
+ * pages, so its lines need few TLB entries; the kernel fills it in lazily,
+ * so sets that are never touched cost no memory.
+ */
+static bool alloc_block(cache_t *cache, size_t size) {
+    if (size >= HUGE_PAGE_SIZE) {
+        size_t mapped = (size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+        char *map = mmap(NULL, mapped + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (map != MAP_FAILED) {
+            // keep the aligned part of a mapping one huge page longer
+            size_t head = -(uintptr_t)map & (HUGE_PAGE_SIZE - 1);
+            if (head > 0)
+                munmap(map, head);
+            munmap(map + head + mapped, HUGE_PAGE_SIZE - head);
+#ifdef MADV_HUGEPAGE
+            madvise(map + head, mapped, MADV_HUGEPAGE);
+#endif
+            cache->block = map + head;
+            cache->block_size = mapped;
+            return true;
+        }
+    }
+
+    void *block;
+    if (posix_memalign(&block, ARRAY_ALIGN, size) != 0)
+        return false;
+    memset(block, 0, size);
+    cache->block = block;
+    cache->block_size = 0;
+    return true;
+}
+
+bool cache_init(cache_t *cache, int s, int E, int b, const char *kernel,
+                const char *policy) {
+    memset(cache, 0, sizeof(*cache));
+    // 2 * E hash slots must fit an int and every array must fit a size_t
+    if (E < 1 || s < 0 || b < 0 || s + b >= 64 || E > INT_MAX / 4 ||
+        (size_t)E > (SIZE_MAX / 64) >> s) {
+        fprintf(stderr, "Invalid cache geometry: s=%d E=%d b=%d\n", s, E, b);
+        return false;
+    }
+    cache->s = s;
+    cache->E = E;
+    cache->b = b;
+    cache->total_sets = 1L << s;
+    cache->total_bytes = 1L << b;
+    cache->set_mask = cache->total_sets - 1;
+    cache->scan_ways = select_scan_kernel(kernel, E);
+    if (cache->scan_ways == NULL) {
+        fprintf(stderr, "Unsupported tag-compare kernel: %s\n", kernel);
+        return false;
+    }
+    if (!cache_parse_policy(policy, &cache->policy, &cache->seed)) {
+        fprintf(stderr, "Unknown replacement policy: %s\n", policy);
+        return false;
+    }
+    if (cache->policy == CACHE_PLRU && (E & (E - 1)) != 0) {
+        fprintf(stderr, "plru needs a power-of-two associativity\n");
+        return false;
+    }
+    cache->run_batch = select_run_kernel(cache, kernel);
+
+    long total_sets = cache->total_sets;
+    size_t lines = (size_t)total_sets * E;
+
+    // a table at most half full keeps linear probe sequences short
+    size_t slots = 0;
+    cache->hash_bits = 0;
+    if (E >= HASH_MIN_ASSOC) {
+        while ((1 << cache->hash_bits) < 2 * E)
+            cache->hash_bits = cache->hash_bits + 1;
+        slots = (size_t)total_sets << cache->hash_bits;
+    }
+
+    size_t sets = (size_t)total_sets;
+    size_t size = 0;
+    size_t tags = carve(&size, lines * sizeof(long));
+    size_t lru_prev = carve(&size, lines * sizeof(int));
+    size_t lru_next = carve(&size, lines * sizeof(int));
+    size_t line_count = carve(&size, sets * sizeof(int));
+    size_t lru_head = carve(&size, sets * sizeof(int));
+    size_t lru_tail = carve(&size, sets * sizeof(int));
+    size_t draws = carve(&size, sets * sizeof(unsigned));
+    size_t hash_slots = carve(&size, slots * sizeof(int));
+    size_t valid_bits = carve(&size, lines);
+    size_t dirty_bits = carve(&size, lines);
+    size_t repl_bits = carve(&size, lines);
+    if (!alloc_block(cache, size)) {
+        fprintf(stderr, "Failed to allocate a cache of %zu lines\n", lines);
+        return false;
+    }
+
+    char *block = cache->block;
+    cache->tags = (long *)(block + tags);
+    cache->lru_prev = (int *)(block + lru_prev);
+    cache->lru_next = (int *)(block + lru_next);
+    cache->line_count = (int *)(block + line_count);
+    cache->lru_head = (int *)(block + lru_head);
+    cache->lru_tail = (int *)(block + lru_tail);
+    cache->draws = (unsigned *)(block + draws);
+    cache->hash_slots = slots ? (int *)(block + hash_slots) : NULL;
+    cache->valid_bits = (unsigned char *)(block + valid_bits);
+    cache->dirty_bits = (unsigned char *)(block + dirty_bits);
+    cache->repl_bits = (unsigned char *)(block + repl_bits);
+
+    // the recency lists of empty sets are never read before lru_insert,
+    // so nothing else is written here and a mapped block stays untouched
+    return true;
+}
+
+void cache_locate(const cache_t *cache, unsigned long addr, long *set_num,
+                  long *tag) {
+    long block = (long)addr >> cache->b;
+    *set_num = block & cache->set_mask;
+    *tag = block >> cache->s;
+}
+
+unsigned long cache_address(const cache_t *cache, long set_num, long tag) {
+    return (unsigned long)((tag << cache->s) | set_num) << cache->b;
+}
+
+int cache_lookup(const cache_t *cache, long set_num, long tag) {
+    int line_count = cache->line_count[set_num];
+    if (line_count == 0)
+        return CACHE_COLD_MISS;
+
+    int way;
+    if (cache->hash_slots) {
+        way = hash_find(cache, set_num, tag);
+    } else {
+        const long *tags = cache->tags + set_num * cache->E;
+        const unsigned char *valid_bits =
+            cache->valid_bits + set_num * cache->E;
+        way = cache->scan_ways(tags, valid_bits, line_count, tag);
+    }
+    if (way != NO_WAY) // hit
+        return way;
+
+    return line_count == cache->E ? CACHE_CAPACITY_MISS : CACHE_COLD_MISS;
+}
+
+/**
+ * @brief cache_fill() for one policy
+ */
+static inline __attribute__((always_inline)) bool
+fill_with(cache_t *cache, csim_stats_t *stats, long set_num, long tag,
+          bool dirty, cache_victim_t *victim, cache_policy_t policy) {
+    long total_bytes = cache->total_bytes;
+    long base = set_num * cache->E;
+    bool evicted = cache->line_count[set_num] == cache->E;
+    int way;
+
+    if (!evicted) {
+        // fill the next free way
+        way = cache->line_count[set_num];
+        cache->line_count[set_num] = cache->line_count[set_num] + 1;
+        init_line(cache, base + way, tag);
+        repl_fill(cache, set_num, way, true, policy);
+        if (cache->hash_slots)
+            hash_insert(cache, set_num, tag, way);
+    } else {
+        // reuse the victim's way for the new line
+        way = repl_victim(cache, set_num, policy);
+        long idx = base + way;
+        stats->evictions = stats->evictions + 1;
+        if (cache->dirty_bits[idx] == 1) {
+            stats->dirty_evictions = stats->dirty_evictions + total_bytes;
+            stats->dirty_bytes = stats->dirty_bytes - total_bytes;
+        }
+        if (victim) {
+            victim->tag = cache->tags[idx];
+            victim->dirty = cache->dirty_bits[idx] == 1;
+        }
+
+        if (cache->hash_slots) {
+            hash_remove(cache, set_num, cache->tags[idx]);
+            hash_insert(cache, set_num, tag, way);
+        }
+        init_line(cache, idx, tag);
+        repl_fill(cache, set_num, way, false, policy);
+    }
+
+    if (dirty) {
+        stats->dirty_bytes = stats->dirty_bytes + total_bytes;
+        cache->dirty_bits[base + way] = 1;
+    }
+    return evicted;
+}
+
+/**
+ * @brief cache_access() for one policy
+ */
+static inline __attribute__((always_inline)) int
+access_with(cache_t *cache, csim_stats_t *stats, long set_num, long tag,
+            bool is_load, cache_victim_t *victim, cache_policy_t policy) {
+    int type = cache_lookup(cache, set_num, tag);
+
+    // miss
+    if (type < 0) {
+        stats->misses = stats->misses + 1;
+        fill_with(cache, stats, set_num, tag, !is_load, victim, policy);
+        return type;
+    }
+
+    // hit, update the line's replacement state
+    long idx = set_num * cache->E + type;
+    repl_hit(cache, set_num, type, policy);
+    stats->hits = stats->hits + 1;
+    if (!is_load && cache->dirty_bits[idx] == 0) {
+        stats->dirty_bytes = stats->dirty_bytes + cache->total_bytes;
+        cache->dirty_bits[idx] = 1;
+    }
+    return type;
+}
+
+/**
+ * @brief Instantiate the single-access and batch entry points of a policy
+ */
+#define DEFINE_POLICY(name, policy)                                            \
+    static int access_##name(cache_t *cache, csim_stats_t *stats,             \
+                             long set_num, long tag, bool is_load,            \
+                             cache_victim_t *victim) {                        \
+        return access_with(cache, stats, set_num, tag, is_load, victim,       \
+                           policy);                                           \
+    }                                                                          \
+    static void run_##name(cache_t *cache, csim_stats_t *stats,               \
+                           const trace_access_t *accesses, int count) {       \
+        for (int i = 0; i < count; i++) {                                      \
+            long set_num, tag;                                                 \
+            cache_locate(cache, accesses[i].addr, &set_num, &tag);             \
+            access_with(cache, stats, set_num, tag, accesses[i].is_load, NULL, \
+                        policy);                                               \
+        }                                                                      \
+    }
+
+DEFINE_POLICY(lru, CACHE_LRU)
+DEFINE_POLICY(fifo, CACHE_FIFO)
+DEFINE_POLICY(plru, CACHE_PLRU)
+DEFINE_POLICY(srrip, CACHE_SRRIP)
+DEFINE_POLICY(brrip, CACHE_BRRIP)
+DEFINE_POLICY(random, CACHE_RANDOM)
+
+int cache_access(cache_t *cache, csim_stats_t *stats, long set_num, long tag,
+                 bool is_load, cache_victim_t *victim) {
+    switch (cache->policy) {
+    case CACHE_FIFO:
+        return access_fifo(cache, stats, set_num, tag, is_load, victim);
+    case CACHE_PLRU:
+        return access_plru(cache, stats, set_num, tag, is_load, victim);
+    case CACHE_SRRIP:
+        return access_srrip(cache, stats, set_num, tag, is_load, victim);
+    case CACHE_BRRIP:
+        return access_brrip(cache, stats, set_num, tag, is_load, victim);
+    case CACHE_RANDOM:
+        return access_random(cache, stats, set_num, tag, is_load, victim);
+    case CACHE_LRU:
+        break;
+    }
+    return access_lru(cache, stats, set_num, tag, is_load, victim);
+}
+
+/**
+ * @brief Batch loop of an LRU cache whose geometry is partly or fully known
+ * at compile time; a dimension passed as ANY_GEOMETRY is read from cache.
+ *
+ * With constant dimensions the shifts and masks are immediates and the way
+ * scan is a fixed, fully unrolled sequence of compares. Hits and evictions
+ * are handled inline; cold fills are rare and go through fill_with(). For
+ * E = 1 a warm access is one tag load, one compare and at most one store.
+ */
+#define ANY_GEOMETRY -1
+
+static inline __attribute__((always_inline)) void
+run_geometry(cache_t *cache, csim_stats_t *stats,
+             const trace_access_t *accesses, int count, const int S,
+             const int E, const int B) {
+    const int s = S != ANY_GEOMETRY ? S : cache->s;
+    const int assoc = E != ANY_GEOMETRY ? E : cache->E;
+    const int b = B != ANY_GEOMETRY ? B : cache->b;
+    const long set_mask = (1L << s) - 1;
+    const long total_bytes = 1L << b;
+
+    for (int i = 0; i < count; i++) {
+        long block = (long)accesses[i].addr >> b;
+        long set_num = block & set_mask;
+        long tag = block >> s;
+        bool is_load = accesses[i].is_load;
+        long base = set_num * assoc;
+        const long *tags = cache->tags + base;
+        const unsigned char *valid_bits = cache->valid_bits + base;
+
+        // tags are unique within a set, so at most one way matches
+        int way = NO_WAY;
+        for (int w = 0; w < assoc; w++)
+            way = tags[w] == tag && valid_bits[w] ? w : way;
+
+        if (way != NO_WAY) {
+            long idx = base + way;
+            if (assoc > 1)
+                lru_promote(cache, set_num, way);
+            stats->hits = stats->hits + 1;
+            if (!is_load && cache->dirty_bits[idx] == 0) {
+                stats->dirty_bytes = stats->dirty_bytes + total_bytes;
+                cache->dirty_bits[idx] = 1;
+            }
+            continue;
+        }
+
+        stats->misses = stats->misses + 1;
+        if (cache->line_count[set_num] < assoc) {
+            fill_with(cache, stats, set_num, tag, !is_load, NULL, CACHE_LRU);
+            continue;
+        }
+
+        // evict the least recently used way, which stays valid
+        way = assoc > 1 ? cache->lru_head[set_num] : 0;
+        long idx = base + way;
+        stats->evictions = stats->evictions + 1;
+        if (cache->dirty_bits[idx] == 1) {
+            stats->dirty_evictions = stats->dirty_evictions + total_bytes;
+            stats->dirty_bytes = stats->dirty_bytes - total_bytes;
+        }
+        cache->tags[idx] = tag;
+        cache->dirty_bits[idx] = !is_load;
+        if (!is_load)
+            stats->dirty_bytes = stats->dirty_bytes + total_bytes;
+        if (assoc > 1)
+            lru_promote(cache, set_num, way);
+    }
+}
+
+/**
+ * @brief Instantiate a batch loop for one LRU geometry
+ */
+#define DEFINE_GEOMETRY(name, S, E, B)                                         \
+    static void run_##name(cache_t *cache, csim_stats_t *stats,               \
+                           const trace_access_t *accesses, int count) {       \
+        run_geometry(cache, stats, accesses, count, S, E, B);                  \
+    }
+
+/* the transpose grading cache and Haswell L1 */
+DEFINE_GEOMETRY(test, TEST_LOG_SET, TEST_ASSOC, TEST_LOG_BLOCK)
+DEFINE_GEOMETRY(haswell_l1, HASWELL_L1_SET, HASWELL_L1_ASSOC, HASWELL_L1_BLOCK)
+DEFINE_GEOMETRY(e1, ANY_GEOMETRY, 1, ANY_GEOMETRY)
+DEFINE_GEOMETRY(e2, ANY_GEOMETRY, 2, ANY_GEOMETRY)
+DEFINE_GEOMETRY(e4, ANY_GEOMETRY, 4, ANY_GEOMETRY)
+DEFINE_GEOMETRY(e8, ANY_GEOMETRY, 8, ANY_GEOMETRY)
+DEFINE_GEOMETRY(e16, ANY_GEOMETRY, 16, ANY_GEOMETRY)
+
+/**
+ * @brief Pick the batch loop of a cache: a specialized LRU geometry when
+ * one matches and the tag-compare kernel is left to "auto", otherwise the
+ * generic loop of its policy
+ */
+static cache_run_fn_t select_run_kernel(const cache_t *cache,
+                                        const char *kernel) {
+    bool lru = cache->policy == CACHE_LRU;
+    if (lru && strcmp(kernel, "auto") == 0) {
+        if (cache->s == TEST_LOG_SET && cache->E == TEST_ASSOC &&
+            cache->b == TEST_LOG_BLOCK)
+            return run_test;
+        if (cache->s == HASWELL_L1_SET && cache->E == HASWELL_L1_ASSOC &&
+            cache->b == HASWELL_L1_BLOCK)
+            return run_haswell_l1;
+        switch (cache->E) {
+        case 1:
+            return run_e1;
+        case 2:
+            return run_e2;
+        case 4:
+            return run_e4;
+        case 8:
+            return run_e8;
+        case 16:
+            return run_e16;
+        }
+    }
+
+    switch (cache->policy) {
+    case CACHE_FIFO:
+        return run_fifo;
+    case CACHE_PLRU:
+        return run_plru;
+    case CACHE_SRRIP:
+        return run_srrip;
+    case CACHE_BRRIP:
+        return run_brrip;
+    case CACHE_RANDOM:
+        return run_random;
+    case CACHE_LRU:
+        break;
+    }
+    return run_lru;
+}
+
+void cache_run(cache_t *cache, csim_stats_t *stats,
+               const trace_access_t *accesses, int count) {
+    cache->run_batch(cache, stats, accesses, count);
+}
+
+void cache_run_trace(cache_t *cache, trace_reader_t *reader) {
+    const trace_access_t *run;
+    long count;
+
+    while ((count = trace_next_run(reader, &run)) > 0)
+        cache->run_batch(cache, &cache->stats, run, (int)count);
+}
+
+bool cache_simulate(int s, int E, int b, const char *file_name,
+                    csim_stats_t *stats) {
+    cache_t cache;
+    trace_reader_t reader;
+
+    if (!cache_init(&cache, s, E, b, "auto", "lru"))
+        return false;
+    if (!trace_open(&reader, file_name)) {
+        cache_free(&cache);
+        return false;
+    }
+    cache_run_trace(&cache, &reader);
+    bool ok = trace_close(&reader);
+    *stats = cache.stats;
+    cache_free(&cache);
+    return ok;
+}
+
+bool cache_fill(cache_t *cache, csim_stats_t *stats, long set_num, long tag,
+                bool dirty, cache_victim_t *victim) {
+    return fill_with(cache, stats, set_num, tag, dirty, victim, cache->policy);
+}
+
+bool cache_invalidate(cache_t *cache, csim_stats_t *stats, long set_num,
+                      long tag, bool *dirty) {
+    int way = cache_lookup(cache, set_num, tag);
+    if (way < 0)
+        return false;
+
+    long base = set_num * cache->E;
+    *dirty = cache->dirty_bits[base + way] == 1;
+    if (*dirty)
+        stats->dirty_bytes = stats->dirty_bytes - cache->total_bytes;
+    bool lists = cache->policy == CACHE_LRU || cache->policy == CACHE_FIFO;
+    if (cache->hash_slots)
+        hash_remove(cache, set_num, tag);
+    if (lists)
+        lru_unlink(cache, set_num, way);
+
+    // move the last filled way into the hole, so filled ways stay contiguous
+    int last = cache->line_count[set_num] - 1;
+    if (way != last) {
+        long from = base + last;
+        long to = base + way;
+        if (cache->hash_slots)
+            hash_remove(cache, set_num, cache->tags[from]);
+        cache->tags[to] = cache->tags[from];
+        cache->valid_bits[to] = cache->valid_bits[from];
+        cache->dirty_bits[to] = cache->dirty_bits[from];
+
+        // a PLRU tree describes positions, so it stays as it is
+        if (cache->policy == CACHE_SRRIP || cache->policy == CACHE_BRRIP)
+            cache->repl_bits[to] = cache->repl_bits[from];
+        if (lists) {
+            int prev = cache->lru_prev[from];
+            int next = cache->lru_next[from];
+            cache->lru_prev[to] = prev;
+            cache->lru_next[to] = next;
+            if (prev == NO_WAY)
+                cache->lru_head[set_num] = way;
+            else
+                cache->lru_next[base + prev] = way;
+            if (next == NO_WAY)
+                cache->lru_tail[set_num] = way;
+            else
+                cache->lru_prev[base + next] = way;
+        }
+        if (cache->hash_slots)
+            hash_insert(cache, set_num, cache->tags[to], way);
+    }
+    cache->valid_bits[base + last] = 0;
+    cache->dirty_bits[base + last] = 0;
+    cache->line_count[set_num] = last;
+    return true;
+}
+
+void cache_free(cache_t *cache) {
+    // every array lives in the one block
+    if (cache->block_size > 0)
+        munmap(cache->block, cache->block_size);
+    else
+        free(cache->block);
+    cache->block = NULL;
+    cache->tags = NULL;
+}
+
+/**
+ * @brief Header of one cache in a snapshot
+ */
+typedef struct {
+    int32_t s, E, b, policy;
+    uint64_t seed;
+    int64_t stats[5]; /* in printSummary() order */
+    int64_t sets;     /* number of set records that follow */
+} snapshot_cache_t;
+
+/**
+ * @brief Header of one set in a snapshot, followed by line_count tags,
+ * lru_prev and lru_next entries, line_count dirty bits and the E repl_bits
+ * of the set
+ */
+typedef struct {
+    int64_t set_num;
+    int32_t line_count, lru_head, lru_tail;
+    uint32_t draws;
+} snapshot_set_t;
+
+/**
+ * @brief True if set_num holds anything a snapshot must keep
+ */
+static bool set_in_use(const cache_t *cache, long set_num) {
+    return cache->line_count[set_num] > 0 || cache->draws[set_num] != 0;
+}
+
+/**
+ * @brief Write the state of one cache, see snapshot_set_t
+ */
+static bool save_cache(const cache_t *cache, FILE *fp) {
+    snapshot_cache_t head = {cache->s, cache->E, cache->b, cache->policy,
+                             cache->seed};
+    head.stats[0] = cache->stats.hits;
+    head.stats[1] = cache->stats.misses;
+    head.stats[2] = cache->stats.evictions;
+    head.stats[3] = cache->stats.dirty_bytes;
+    head.stats[4] = cache->stats.dirty_evictions;
+    for (long i = 0; i < cache->total_sets; i++)
+        head.sets = head.sets + set_in_use(cache, i);
+    if (fwrite(&head, sizeof(head), 1, fp) != 1)
+        return false;
+
+    for (long i = 0; i < cache->total_sets; i++) {
+        if (!set_in_use(cache, i))
+            continue;
+        long base = i * cache->E;
+        int count = cache->line_count[i];
+        snapshot_set_t set = {i, count, cache->lru_head[i],
+                              cache->lru_tail[i], cache->draws[i]};
+        if (fwrite(&set, sizeof(set), 1, fp) != 1 ||
+            fwrite(cache->tags + base, sizeof(long), count, fp) != count ||
+            fwrite(cache->lru_prev + base, sizeof(int), count, fp) != count ||
+            fwrite(cache->lru_next + base, sizeof(int), count, fp) != count ||
+            fwrite(cache->dirty_bits + base, 1, count, fp) != count ||
+            fwrite(cache->repl_bits + base, 1, cache->E, fp) != cache->E)
+            return false;
+    }
+    return true;
+}
+
+/**
+ * @brief True if no two filled ways of set i hold the same tag. A hashed
+ * set is indexed on the way, as a full table would never end a probe.
+ */
+static bool unique_tags(cache_t *cache, long i) {
+    long base = i * cache->E;
+    int count = cache->line_count[i];
+    for (int way = 0; way < count; way++) {
+        long tag = cache->tags[base + way];
+        if (cache->hash_slots) {
+            if (hash_find(cache, i, tag) != NO_WAY)
+                return false;
+            hash_insert(cache, i, tag, way);
+            continue;
+        }
+        for (int other = 0; other < way; other++) {
+            if (cache->tags[base + other] == tag)
+                return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief True if the state of set i read from a snapshot is one the access
+ * path can index with: distinct tags, dirty bits of 0 or 1, for LRU and
+ * FIFO one recency list through exactly the filled ways, PLRU tree bits of
+ * 0 or 1 and RRIP values up to RRPV_MAX
+ */
+static bool valid_set(cache_t *cache, long i) {
+    long base = i * cache->E;
+    int count = cache->line_count[i];
+    if (!unique_tags(cache, i))
+        return false;
+    for (int way = 0; way < count; way++) {
+        if (cache->dirty_bits[base + way] > 1)
+            return false;
+    }
+
+    switch (cache->policy) {
+    case CACHE_LRU:
+    case CACHE_FIFO: {
+        // every step must come back through lru_prev, so a list that
+        // reaches the tail in count steps visits every filled way once
+        int prev = NO_WAY;
+        int way = cache->lru_head[i];
+        for (int n = 0; n < count; n++) {
+            if (way < 0 || way >= count || cache->lru_prev[base + way] != prev)
+                return false;
+            prev = way;
+            way = cache->lru_next[base + way];
+        }
+        return way == NO_WAY && cache->lru_tail[i] == prev &&
+               (count > 0 || cache->lru_head[i] == NO_WAY);
+    }
+    case CACHE_PLRU:
+        for (int node = 0; node < cache->E; node++) {
+            if (cache->repl_bits[base + node] > 1)
+                return false;
+        }
+        return true;
+    case CACHE_SRRIP:
+    case CACHE_BRRIP:
+        for (int way = 0; way < cache->E; way++) {
+            if (cache->repl_bits[base + way] > RRPV_MAX)
+                return false;
+        }
+        return true;
+    case CACHE_RANDOM:
+        break;
+    }
+    return true;
+}
+
+/**
+ * @brief Read the state of one cache written by save_cache()
+ */
+static bool load_cache(cache_t *cache, FILE *fp, const char *kernel) {
+    snapshot_cache_t head;
+    if (fread(&head, sizeof(head), 1, fp) != 1 || head.policy < 0 ||
+        head.policy > CACHE_RANDOM || head.s < 0 || head.s > 40 ||
+        head.E <= 0 || head.b < 0 || head.b > 40)
+        return false;
+    if (!cache_init(cache, head.s, head.E, head.b, kernel,
+                    policy_names[head.policy]))
+        return false;
+    cache->seed = head.seed;
+    cache->stats.hits = head.stats[0];
+    cache->stats.misses = head.stats[1];
+    cache->stats.evictions = head.stats[2];
+    cache->stats.dirty_bytes = head.stats[3];
+    cache->stats.dirty_evictions = head.stats[4];
+
+    // save_cache() writes the sets in order, so a repeated set is corrupt
+    long last = -1;
+    for (int64_t n = 0; n < head.sets; n++) {
+        snapshot_set_t set;
+        if (fread(&set, sizeof(set), 1, fp) != 1 || set.set_num <= last ||
+            set.set_num >= cache->total_sets || set.line_count < 0 ||
+            set.line_count > cache->E)
+            goto corrupt;
+        last = set.set_num;
+        long i = set.set_num;
+        long base = i * cache->E;
+        int count = set.line_count;
+        cache->line_count[i] = count;
+        cache->lru_head[i] = set.lru_head;
+        cache->lru_tail[i] = set.lru_tail;
+        cache->draws[i] = set.draws;
+        if (fread(cache->tags + base, sizeof(long), count, fp) != count ||
+            fread(cache->lru_prev + base, sizeof(int), count, fp) != count ||
+            fread(cache->lru_next + base, sizeof(int), count, fp) != count ||
+            fread(cache->dirty_bits + base, 1, count, fp) != count ||
+            fread(cache->repl_bits + base, 1, cache->E, fp) != cache->E)
+            goto corrupt;
+
+        // other policies never read the recency lists
+        bool lists = cache->policy == CACHE_LRU || cache->policy == CACHE_FIFO;
+        if (!lists) {
+            cache->lru_head[i] = cache->lru_tail[i] = NO_WAY;
+            for (int way = 0; way < count; way++)
+                cache->lru_prev[base + way] = cache->lru_next[base + way] =
+                    NO_WAY;
+        }
+        if (!valid_set(cache, i))
+            goto corrupt;
+
+        // filled ways are always 0 .. line_count - 1
+        memset(cache->valid_bits + base, 1, count);
+    }
+    return true;
+
+corrupt:
+    cache_free(cache);
+    return false;
+}
+
+bool cache_save_snapshot(const char *file_name, const cache_t *caches,
+                         int count) {
+    FILE *fp = fopen(file_name, "wb");
+    if (fp == NULL) {
+        fprintf(stderr, "Error creating snapshot %s: %s\n", file_name,
+                strerror(errno));
+        return false;
+    }
+
+    uint32_t header[2] = {SNAPSHOT_VERSION, (uint32_t)count};
+    bool ok = fwrite(SNAPSHOT_MAGIC, 8, 1, fp) == 1 &&
+              fwrite(header, sizeof(header), 1, fp) == 1;
+    for (int c = 0; c < count && ok; c++)
+        ok = save_cache(&caches[c], fp);
+    ok = fclose(fp) == 0 && ok;
+    if (!ok)
+        fprintf(stderr, "Error writing snapshot %s\n", file_name);
+    return ok;
+}
+
+int cache_load_snapshot(const char *file_name, cache_t *caches, int max,
+                        const char *kernel) {
+    FILE *fp = fopen(file_name, "rb");
+    if (fp == NULL) {
+        fprintf(stderr, "Error opening snapshot %s: %s\n", file_name,
+                strerror(errno));
+        return -1;
+    }
+
+    char magic[8];
+    uint32_t header[2];
+    if (fread(magic, 8, 1, fp) != 1 || memcmp(magic, SNAPSHOT_MAGIC, 8) != 0 ||
+        fread(header, sizeof(header), 1, fp) != 1 ||
+        header[0] != SNAPSHOT_VERSION || header[1] > (uint32_t)max) {
+        fprintf(stderr, "%s is not a snapshot this csim can read\n",
+                file_name);
+        fclose(fp);
+        return -1;
+    }
+
+    int count = (int)header[1];
+    for (int c = 0; c < count; c++) {
+        if (!load_cache(&caches[c], fp, kernel)) {
+            fprintf(stderr, "Snapshot %s is truncated or corrupt\n",
+                    file_name);
+            for (int i = 0; i < c; i++)
+                cache_free(&caches[i]);
+            fclose(fp);
+            return -1;
+        }
+    }
+    fclose(fp);
+    return count;
+}
@@ -0,0 +1,206 @@
+/**
+ * @file cache.h
+ * @brief Set-associative cache engine shared by the csim front ends
+ *
+ * A cache_t holds no pointers to global state, so any number of caches can
+ * be simulated side by side, and different sets of one cache can be updated
+ * from different threads as long as each set has a single owner and every
+ * thread keeps its own csim_stats_t.
+ *
+ * The replacement policy is fixed when the cache is built. The access path
+ * is compiled once per policy, so no access goes through a function
+ * pointer for replacement.
+ */
+
+#ifndef CACHELAB_CACHE_H
+#define CACHELAB_CACHE_H
+
+#include <stdbool.h>
+
+#include "cachelab.h"
+#include "trace.h"
+
+/** @brief cache_lookup() result: the set has a free way for the line */
+#define CACHE_COLD_MISS -1
+
+/** @brief cache_lookup() result: the set is full, a line must be evicted */
+#define CACHE_CAPACITY_MISS -2
+
+/**
+ * @brief Replacement policies, named on the command line as in the comments
+ */
+typedef enum {
+    CACHE_LRU,    /* "lru", least recently used */
+    CACHE_FIFO,   /* "fifo", oldest fill */
+    CACHE_PLRU,   /* "plru", tree pseudo-LRU, E must be a power of two */
+    CACHE_SRRIP,  /* "srrip", static re-reference interval prediction */
+    CACHE_BRRIP,  /* "brrip", bimodal RRIP, resists scans */
+    CACHE_RANDOM, /* "random" or "random:<seed>" */
+} cache_policy_t;
+
+/**
+ * @brief A tag-compare kernel returns the lowest valid way among the first
+ * count ways whose tag equals tag, or -1.
+ */
+typedef int (*cache_scan_fn_t)(const long *tags,
+                               const unsigned char *valid_bits, int count,
+                               long tag);
+
+struct cache;
+
+/**
+ * @brief A batch loop, see cache_run()
+ */
+typedef void (*cache_run_fn_t)(struct cache *cache, csim_stats_t *stats,
+                               const trace_access_t *accesses, int count);
+
+/**
+ * @brief One simulated cache: its geometry, statistics and line storage.
+ *
+ * Way w of set i lives at index i * E + w of each per-line array, so the
+ * ways of one set are a single contiguous run. The filled ways of a set are
+ * always ways 0 .. line_count - 1. All arrays are carved out of one
+ * block, each on a 64-byte boundary; a block of 2 MiB or more is mapped on
+ * huge pages. cache_free() releases it in one call.
+ */
+typedef struct cache {
+    int s;                     /* log2 of the number of sets */
+    int E;                     /* associativity */
+    int b;                     /* log2 of the block size */
+    long total_sets;
+    long total_bytes;          /* bytes per block */
+    long set_mask;
+    cache_scan_fn_t scan_ways; /* tag-compare kernel for this associativity */
+    cache_run_fn_t run_batch;  /* batch loop for this geometry and policy */
+    cache_policy_t policy;
+    unsigned long seed;        /* of the random choices of RANDOM and BRRIP */
+    csim_stats_t stats;
+
+    long *tags;
+    int *lru_prev;             /* next less recently used way, or -1 */
+    int *lru_next;             /* next more recently used way, or -1 */
+    int *line_count;           /* number of filled ways, one entry per set */
+    int *lru_head;             /* least recently used way of each set */
+    int *lru_tail;             /* most recently used way of each set */
+    unsigned *draws;           /* random numbers drawn, one entry per set */
+    unsigned char *repl_bits;  /* re-reference value (RRIP) of each line, or
+                                  the tree of each set (PLRU) */
+    unsigned char *valid_bits; /* 1 if the way holds a line */
+    unsigned char *dirty_bits; /* 1 if the line was written */
+    int *hash_slots;           /* tag index, way + 1 or 0, NULL if unused */
+    int hash_bits;             /* log2 of the number of slots per set */
+    void *block;               /* the allocation every array is part of */
+    size_t block_size;         /* bytes mapped for block, 0 if malloc'd */
+} cache_t;
+
+/**
+ * @brief A line pushed out of a full set
+ */
+typedef struct {
+    long tag;
+    bool dirty;
+} cache_victim_t;
+
+/**
+ * @brief Set up an empty cache of 2^s sets of E ways of 2^b bytes.
+ *
+ * kernel names the tag-compare kernel: "auto" picks one by CPU features,
+ * otherwise "scalar", "sse2", "avx2" or "avx512". policy names the
+ * replacement policy, see cache_policy_t. Fails unless E >= 1, s >= 0,
+ * b >= 0 and s + b < 64.
+ */
+bool cache_init(cache_t *cache, int s, int E, int b, const char *kernel,
+                const char *policy);
+
+/**
+ * @brief Parse a policy name with an optional ":<seed>" suffix into *policy
+ * and *seed. Return false if it names no policy.
+ */
+bool cache_parse_policy(const char *name, cache_policy_t *policy,
+                        unsigned long *seed);
+
+/** @brief Split an address into its set number and tag */
+void cache_locate(const cache_t *cache, unsigned long addr, long *set_num,
+                  long *tag);
+
+/** @brief First byte of the block with this set number and tag */
+unsigned long cache_address(const cache_t *cache, long set_num, long tag);
+
+/**
+ * @brief Way of set_num holding tag, or CACHE_COLD_MISS or
+ * CACHE_CAPACITY_MISS. Nothing is updated.
+ */
+int cache_lookup(const cache_t *cache, long set_num, long tag);
+
+/**
+ * @brief Run one load or store through set_num, updating stats.
+ *
+ * A miss fills the line, evicting the line the replacement policy picks
+ * from a full set into *victim when victim is not NULL. Return the
+ * cache_lookup() result from before the access.
+ */
+int cache_access(cache_t *cache, csim_stats_t *stats, long set_num, long tag,
+                 bool is_load, cache_victim_t *victim);
+
+/**
+ * @brief cache_access() every access of accesses in order, without victims.
+ *
+ * This goes through a loop picked when the cache was built: one specialized
+ * for its geometry when there is one, otherwise one for its policy.
+ */
+void cache_run(cache_t *cache, csim_stats_t *stats,
+               const trace_access_t *accesses, int count);
+
+/**
+ * @brief cache_run() every remaining access of reader into cache->stats
+ */
+void cache_run_trace(cache_t *cache, trace_reader_t *reader);
+
+/**
+ * @brief Simulate the whole trace file_name on an empty LRU cache of 2^s
+ * sets of E ways of 2^b bytes and store its statistics in *stats.
+ *
+ * This is what csim -s s -E E -b b -t file_name computes, without starting
+ * a process or going through .csim_results.
+ */
+bool cache_simulate(int s, int E, int b, const char *file_name,
+                    csim_stats_t *stats);
+
+/**
+ * @brief Put a line cache_lookup() did not find into set_num without
+ * counting a hit or miss. Return true if a line had to be evicted into
+ * *victim, which may be NULL.
+ */
+bool cache_fill(cache_t *cache, csim_stats_t *stats, long set_num, long tag,
+                bool dirty, cache_victim_t *victim);
+
+/**
+ * @brief Drop the line holding tag, if any, without counting an eviction.
+ * Return true if it was present, with its dirty bit in *dirty.
+ */
+bool cache_invalidate(cache_t *cache, csim_stats_t *stats, long set_num,
+                      long tag, bool *dirty);
+
+/** @brief Release the line storage */
+void cache_free(cache_t *cache);
+
+/**
+ * @brief Write the complete state of count caches to a snapshot file.
+ *
+ * A snapshot holds each cache's geometry, replacement policy, random seed
+ * and statistics, followed by one record per set that holds lines or has
+ * drawn random numbers: its tags, recency lists, dirty bits and
+ * replacement bits. Fields are in host byte order.
+ */
+bool cache_save_snapshot(const char *file_name, const cache_t *caches,
+                         int count);
+
+/**
+ * @brief Rebuild the caches of a snapshot into caches, at most max of them,
+ * using the tag-compare kernel named kernel. Return how many there were,
+ * or -1 on error.
+ */
+int cache_load_snapshot(const char *file_name, cache_t *caches, int max,
+                        const char *kernel);
+
+#endif /* CACHELAB_CACHE_H */
@@ -11,6 +11,9 @@
 
 #include "cachelab.h"
 
+/** @brief Side of the tiles correctTrans() works on */
+#define CORRECT_BLOCK 16
+
 trans_func_t func_list[MAX_TRANS_FUNCS];
 int func_counter = 0;
 
@@ -71,17 +74,19 @@ bool loadSummary(csim_stats_t *stats) {
 
 /**
  * @brief Initialize the given matrices
+ *
+ * Both are filled in row order; the values only need to be ones that
+ * can't be represented as int or float.
  */
 void initMatrix(size_t M, size_t N, double A[N][M], double B[M][N]) {
     size_t i, j;
     srand(time(NULL));
-    for (i = 0; i < N; i++) {
-        for (j = 0; j < M; j++) {
-            /* Initialize with data that can't be represented as int or float */
+    for (i = 0; i < N; i++)
+        for (j = 0; j < M; j++)
             A[i][j] = (double)rand() / 8.0 + 1e10;
+    for (j = 0; j < M; j++)
+        for (i = 0; i < N; i++)
             B[j][i] = (double)rand() / 8.0 + 1e10;
-        }
-    }
 }
 
 /**
@@ -89,22 +94,23 @@ void initMatrix(size_t M, size_t N, double A[N][M], double B[M][N]) {
  */
 void copyMatrix(size_t M, size_t N, double Adst[N][M],
                 const double Asrc[N][M]) {
-    size_t i, j;
-    for (i = 0; i < N; i++)
-        for (j = 0; j < M; j++)
-            Adst[i][j] = Asrc[i][j];
+    memcpy(Adst, Asrc, N * M * sizeof(double));
 }
 
 /**
  * @brief baseline transpose function used to evaluate correctness
+ *
+ * Works on CORRECT_BLOCK x CORRECT_BLOCK tiles so that the rows of B being
+ * written stay in the cache while a tile of A is read.
  */
 void correctTrans(size_t M, size_t N, const double A[N][M], double B[M][N]) {
-    size_t i, j;
-    double tmp;
-    for (i = 0; i < N; i++) {
-        for (j = 0; j < M; j++) {
-            tmp = A[i][j];
-            B[j][i] = tmp;
+    for (size_t ii = 0; ii < N; ii += CORRECT_BLOCK) {
+        size_t i_end = ii + CORRECT_BLOCK < N ? ii + CORRECT_BLOCK : N;
+        for (size_t jj = 0; jj < M; jj += CORRECT_BLOCK) {
+            size_t j_end = jj + CORRECT_BLOCK < M ? jj + CORRECT_BLOCK : M;
+            for (size_t i = ii; i < i_end; i++)
+                for (size_t j = jj; j < j_end; j++)
+                    B[j][i] = A[i][j];
         }
     }
 }
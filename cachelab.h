@@ -34,6 +34,12 @@ bool loadSummary(csim_stats_t *stats);
 /** @brief Number of clock cycles for miss */
 #define MISS_CYCLES 100
 
+/** @brief Accesses in flight at once in the timing model of test-trans -t */
+#define TIMING_WINDOW 64
+
+/** @brief Misses outstanding at once in the timing model of test-trans -t */
+#define TIMING_MSHRS 10
+
 /** @brief Log number of sets */
 #define TEST_LOG_SET 5
 
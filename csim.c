@@ -3,241 +3,675 @@
  * AndrewID: taowang
  */
 
+#define _DEFAULT_SOURCE /* for sched_yield */
+
+#include "cache.h"
 #include "cachelab.h"
+#include "eventlog.h"
+#include "hierarchy.h"
+#include "prefetch.h"
+#include "profile.h"
+#include "sample.h"
+#include "stackdist.h"
+#include "trace.h"
+#include <fcntl.h>
 #include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
-typedef struct line_s line_t;
-struct line_s {
-    int dirty_bit;
-    int valid_bit;
+/* Most caches -c can simulate in one pass over the trace */
+#define MAX_CONFIGS 64
+
+/* Most worker threads -j can start */
+#define MAX_THREADS 64
+
+/* Accesses per batch and batches per queue between parser and a worker */
+#define SHARD_BATCH 1024
+#define SHARD_RING 8
+
+/**
+ * Everything the command line selects, including the caches it describes
+ */
+typedef struct {
+    int s;
+    int E;
+    int b;
+    int verbose;
+    int help;
+    int all_assoc;
+    int threads;
+    int decoders;     /* -D, threads decoding a text trace, 0 for none */
+    int split_blocks; /* -B, split accesses at block boundaries */
+    const char *file_name;
+    const char *kernel_name;
+    const char *policy_name;    /* -p, the replacement policy */
+    int policy_given;           /* -p was given, not left at lru */
+    const char *hierarchy_file; /* -H, NULL for single-level caches */
+    int set_ratio;              /* -S, sample 1/set_ratio of the sets */
+    long period;                /* -T period,warmup,measure */
+    long warmup;
+    long measure;
+    const char *restore_file; /* -r, snapshot the caches start from */
+    const char *save_file;    /* -w, snapshot written after the trace */
+    const char *profile_file; /* -o, per-set and per-region report */
+    const char *regions_file; /* -R, address regions of the report */
+    const char *log_file;     /* -L, binary event log */
+    const char *log_filter;   /* -V, events -v and -L keep */
+    eventlog_t logs[2];       /* the -v text log and the -L binary log */
+    int log_count;
+    const char *prefetch_spec; /* -P, NULL without prefetchers */
+    prefetch_config_t prefetch;
+    prefetch_stats_t prefetch_stats[MAX_CONFIGS];
+    cache_t caches[MAX_CONFIGS];
+    int cache_count;
+} csim_options_t;
+
+/**
+ * One access routed to the worker that owns its set
+ */
+typedef struct {
+    long set_num;
     long tag;
-    line_t *next;
-};
+    int cache;   /* index into caches */
+    int is_load;
+} shard_item_t;
 
 typedef struct {
-    int line_count;
-    line_t *first_line;
-    line_t *last_line;
-} set_t;
+    int count;
+    shard_item_t items[SHARD_BATCH];
+} shard_batch_t;
 
-#define COLD_MISS_TYPE -1
-#define CAPACITY_MISS_TYPE -2
-#define UNIT_SIZE 1
-#define BUFFER_SIZE 50
+/**
+ * A worker thread and the lock-free single-producer single-consumer queue
+ * of batches the parser hands it. The parser fills ring[tail % SHARD_RING]
+ * in place and publishes it by advancing tail; the worker frees a slot by
+ * advancing head. The two counters sit on separate cache lines.
+ */
+typedef struct {
+    shard_batch_t ring[SHARD_RING];
+    unsigned long head __attribute__((aligned(64)));
+    unsigned long tail __attribute__((aligned(64)));
+    int fill; /* items in the batch being filled, only used by the parser */
+    bool done;
+    pthread_t thread;
+    cache_t *caches;                 /* the caches this worker shares */
+    csim_stats_t stats[MAX_CONFIGS]; /* this worker's share of each cache */
+} shard_t;
 
 /**
- * Pass parameters from command line to corresponding global variables
+ * Fill opts from the command line and build the caches it describes
  */
-void set_global_values(int argc, char *argv[]);
+void parse_options(csim_options_t *opts, int argc, char *argv[]);
 
 /**
- * Parsing each line in the file to get certain info to position a cache line
+ * Run the whole trace through every cache, a batch of accesses at a time
  */
-void parsing_line(char *s, int *is_load, long *tag, long *set_num);
+void run_batched(csim_options_t *opts, trace_reader_t *reader);
 
 /**
- * Safely use calloc, when calloc is not able to allocate memory
+ * Run one access through a cache, update its statistics and log it
  */
-void *xcalloc(size_t num, size_t size);
+void simulate_access(csim_options_t *opts, cache_t *cache,
+                     const trace_access_t *access, int line_num);
+
+/**
+ * Write the -w snapshot, then print the summary of every cache and release
+ * them
+ */
+void print_results(csim_options_t *opts);
+
+/**
+ * Simulate the trace with sets split across opts->threads worker threads
+ * while this thread parses, then add the per-worker statistics into caches.
+ */
+void run_sharded(csim_options_t *opts, trace_reader_t *reader);
+
+/**
+ * Body of a worker thread, arg is its shard_t
+ */
+void *shard_worker(void *arg);
+
+/**
+ * Report LRU statistics for every E = 1..E from one stack-distance pass
+ */
+void run_all_assoc(const csim_options_t *opts, trace_reader_t *reader);
+
+/**
+ * Run the trace through the hierarchy in opts->hierarchy_file and report
+ * every level, the memory traffic and the average memory access time
+ */
+void run_hierarchy(const csim_options_t *opts, trace_reader_t *reader);
+
+/**
+ * Estimate every cache from a sample of its sets or accesses and report the
+ * estimates with their confidence intervals
+ */
+void run_sampled(csim_options_t *opts, trace_reader_t *reader);
 
 /**
- * when return value >= 0, there is a conflict miss, return value is its
- * positon; when return value is -1, there is a cold miss; when return value is
- * -2, there is a capacity miss.
+ * Run the trace through the only cache while attributing every miss to its
+ * set, address region and 3C class, then write the -o report
  */
-int miss_type(set_t set, long set_num, long tag);
+void run_profiled(csim_options_t *opts, trace_reader_t *reader);
 
 /**
- * Initialize or update this line
+ * Run the trace through every cache with the -P prefetchers in front of it
+ * and keep what they did in opts->prefetch_stats
  */
-void init_line(line_t *line, long tag);
+void run_prefetched(csim_options_t *opts, trace_reader_t *reader);
 
 /**
- * Get line by its position in a certain set.
+ * Make reader split accesses at the block boundaries of the caches for -B,
+ * exit if the caches differ in block size
  */
-line_t *get_line(set_t set, int pos);
+void split_blocks(csim_options_t *opts, trace_reader_t *reader);
 
 /**
- * Free all memory that have allocated in heap
+ * Parse a "s,E,b" configuration given to -c and append it to caches
  */
-void free_mem(set_t *sets, csim_stats_t *stats);
+void add_config(csim_options_t *opts, const char *config);
 
 /**
- * Get the result of pow(2,index)
- * The input and return value are integers.
+ * Load opts->caches from the -r snapshot and check them against the caches
+ * and the policy the command line describes, if any
  */
-int pow2(int index);
+void restore_caches(csim_options_t *opts, const char *configs[],
+                    int config_count);
 
 /**
- * Safely open file in read-only mode
+ * Open the -v and -L event logs, exit on failure
  */
-FILE *file_open(char *file_name);
-
-int s;
-int E;
-int b;
-int verbose = 0;
-int help = 0;
-int total_sets;
-int total_bytes;
-char file_name[50];
-long set_mask;
+void open_logs(csim_options_t *opts);
+
+/**
+ * Flush and close the event logs, exit if they could not be written
+ */
+void close_logs(csim_options_t *opts);
+
+/**
+ * Append a cache with this geometry to opts->caches, exit on failure
+ */
+void add_cache(csim_options_t *opts, int s, int E, int b);
+
+/**
+ * Safely use calloc, when calloc is not able to allocate memory
+ */
+void *xcalloc(size_t num, size_t size);
+
+/**
+ * Close the trace, exit without results if it ended early on an error
+ */
+void close_trace(trace_reader_t *reader);
 
 int main(int argc, char *argv[]) {
-    set_global_values(argc, argv);
-    set_t *sets = xcalloc(total_sets, sizeof(set_t));
-    csim_stats_t *stats = xcalloc(UNIT_SIZE, sizeof(csim_stats_t));
-    char buffer[BUFFER_SIZE];
-    FILE *stream = file_open(file_name);
-    int i = 1;
-
-    while (fgets(buffer, 50, stream)) // read from each line
-    {
-        // load = 1, store = 0
-        int is_load;
-        long tag, set_num;
-        parsing_line(buffer, &is_load, &tag, &set_num);
-        if (verbose == 1)
-            printf("line_num = %d,is_load = %d, set_num = %ld, tag = %lx", i++,
-                   is_load, set_num, tag);
-
-        set_t *this_set = sets + set_num;
-        int type = miss_type(*this_set, set_num, tag);
-
-        // miss
-        if (type == COLD_MISS_TYPE) {
-            if (verbose == 1)
-                printf(" miss\n");
-            // init a new line
-            line_t *new_line = xcalloc(UNIT_SIZE, sizeof(line_t));
-            init_line(new_line, tag);
-
-            if (this_set->line_count == 0) {
-                this_set->first_line = new_line;
-                this_set->last_line = new_line;
-                this_set->line_count = 1;
-            } else {
-                this_set->line_count = this_set->line_count + 1;
-                this_set->last_line->next = new_line;
-                this_set->last_line = new_line;
-            }
+    csim_options_t opts;
+    parse_options(&opts, argc, argv);
+
+    trace_reader_t reader;
+    if (!trace_open(&reader, opts.file_name))
+        exit(1);
+    // a binary or piped trace is still decoded by this thread
+    if (opts.decoders > 0)
+        trace_decode_parallel(&reader, opts.decoders);
+    if (opts.split_blocks)
+        split_blocks(&opts, &reader);
+
+    // a trace cut short by an error exits before any result is printed, so
+    // the modes that report as they finish close it themselves
+    if (opts.hierarchy_file) {
+        run_hierarchy(&opts, &reader);
+        return 0;
+    }
+    if (opts.all_assoc == 1) {
+        run_all_assoc(&opts, &reader);
+        return 0;
+    }
+    if (opts.set_ratio > 0 || opts.period > 0) {
+        run_sampled(&opts, &reader);
+        return 0;
+    }
+    if (opts.profile_file) {
+        run_profiled(&opts, &reader);
+        print_results(&opts);
+        return 0;
+    }
 
-            if (is_load == 0) {
-                stats->dirty_bytes = stats->dirty_bytes + total_bytes;
-                new_line->dirty_bit = 1;
-            }
+    if (opts.prefetch_spec) {
+        run_prefetched(&opts, &reader);
+        close_trace(&reader);
+        close_logs(&opts);
+        print_results(&opts);
+        return 0;
+    }
 
-            // update stats info
-            stats->misses = stats->misses + 1;
+    // logged events must stay in trace order, so they run on one thread
+    if (opts.threads > 1 && opts.log_count == 0) {
+        run_sharded(&opts, &reader);
+        close_trace(&reader);
+        print_results(&opts);
+        return 0;
+    }
+
+    if (opts.log_count == 0) {
+        run_batched(&opts, &reader);
+        close_trace(&reader);
+        print_results(&opts);
+        return 0;
+    }
+
+    trace_access_t access;
+    int i = 0;
+
+    // every cache sees each access right after it is decoded; the blocks
+    // of an access split by -B keep the line number of the access
+    while (trace_next(&reader, &access)) { // read each access
+        if (!access.continued)
+            i++;
+        for (int c = 0; c < opts.cache_count; c++)
+            simulate_access(&opts, &opts.caches[c], &access, i);
+    }
+    close_trace(&reader);
+    close_logs(&opts);
+    print_results(&opts);
+    return 0;
+}
+
+void run_batched(csim_options_t *opts, trace_reader_t *reader) {
+    const trace_access_t *run;
+    long count;
+
+    while ((count = trace_next_run(reader, &run)) > 0) {
+        for (int c = 0; c < opts->cache_count; c++) {
+            cache_t *cache = &opts->caches[c];
+            cache_run(cache, &cache->stats, run, (int)count);
         }
+    }
+}
 
-        // miss eviction
-        if (type == CAPACITY_MISS_TYPE) {
-            if (verbose == 1)
-                printf(" miss eviction\n");
-
-            // init a new line
-            line_t *new_line = xcalloc(UNIT_SIZE, sizeof(line_t));
-            init_line(new_line, tag);
-
-            // use LRU
-            line_t *first_line = this_set->first_line;
-            if (sets[set_num].line_count == 1) {
-                this_set->first_line = new_line;
-                this_set->last_line = new_line;
-            } else {
-                this_set->first_line = first_line->next;
-                this_set->last_line->next = new_line;
-                this_set->last_line = new_line;
-            }
+void print_results(csim_options_t *opts) {
+    if (opts->save_file &&
+        !cache_save_snapshot(opts->save_file, opts->caches, opts->cache_count))
+        exit(1);
+    for (int c = 0; c < opts->cache_count; c++) {
+        cache_t *cache = &opts->caches[c];
+        if (opts->cache_count > 1)
+            printf("s=%d E=%d b=%d ", cache->s, cache->E, cache->b);
+        printSummary(&cache->stats);
+        if (opts->prefetch_spec) {
+            const prefetch_stats_t *pstats = &opts->prefetch_stats[c];
+            printf("prefetch issued:%ld useful:%ld late:%ld polluting:%ld\n",
+                   pstats->issued, pstats->useful, pstats->late,
+                   pstats->polluting);
+        }
+        cache_free(cache);
+    }
+}
+
+void run_sharded(csim_options_t *opts, trace_reader_t *reader) {
+    int threads = opts->threads;
+    // calloc only aligns to 16 bytes, head and tail need their own lines
+    void *block;
+    if (posix_memalign(&block, __alignof__(shard_t),
+                       threads * sizeof(shard_t)) != 0)
+        abort();
+    shard_t *shards = memset(block, 0, threads * sizeof(shard_t));
+    for (int w = 0; w < threads; w++) {
+        shards[w].caches = opts->caches;
+        if (pthread_create(&shards[w].thread, NULL, shard_worker,
+                           &shards[w]) != 0)
+            abort();
+    }
 
-            // update stats info
-            stats->misses = stats->misses + 1;
-            stats->evictions = stats->evictions + 1;
-            // evict dirty update stats info
-            if (first_line->dirty_bit == 1) {
-                stats->dirty_evictions = stats->dirty_evictions + total_bytes;
-                stats->dirty_bytes = stats->dirty_bytes - total_bytes;
+    trace_access_t access;
+    while (trace_next(reader, &access)) {
+        for (int c = 0; c < opts->cache_count; c++) {
+            long tag, set_num;
+            cache_locate(&opts->caches[c], access.addr, &set_num, &tag);
+
+            // contiguous ranges of sets per worker
+            shard_t *shard =
+                &shards[set_num * threads / opts->caches[c].total_sets];
+            unsigned long tail = shard->tail;
+            shard_batch_t *batch = &shard->ring[tail % SHARD_RING];
+            if (shard->fill == 0) {
+                // wait until the worker is done with this slot
+                while (tail - __atomic_load_n(&shard->head, __ATOMIC_ACQUIRE) ==
+                       SHARD_RING)
+                    sched_yield();
             }
 
-            if (is_load == 0) {
-                stats->dirty_bytes = stats->dirty_bytes + total_bytes;
-                new_line->dirty_bit = 1;
+            shard_item_t *item = &batch->items[shard->fill];
+            item->set_num = set_num;
+            item->tag = tag;
+            item->cache = c;
+            item->is_load = access.is_load;
+            shard->fill = shard->fill + 1;
+            if (shard->fill == SHARD_BATCH) {
+                batch->count = shard->fill;
+                shard->fill = 0;
+                __atomic_store_n(&shard->tail, tail + 1, __ATOMIC_RELEASE);
             }
+        }
+    }
 
-            // free memory
-            free(first_line);
+    // publish the partial batches, then let the workers drain and exit
+    for (int w = 0; w < threads; w++) {
+        shard_t *shard = &shards[w];
+        if (shard->fill > 0) {
+            shard->ring[shard->tail % SHARD_RING].count = shard->fill;
+            __atomic_store_n(&shard->tail, shard->tail + 1, __ATOMIC_RELEASE);
         }
+        __atomic_store_n(&shard->done, true, __ATOMIC_RELEASE);
+    }
 
-        // hit
-        if (type >= 0) {
-            if (verbose == 1)
-                printf(" hit\n");
-
-            // update new_line's position
-            line_t *prev_line, *cur_line;
-            if (type == this_set->line_count - 1)
-                cur_line = this_set->last_line;
-            else if (type == 0) {
-                // LRU, first line
-                cur_line = this_set->first_line;
-                this_set->first_line = cur_line->next;
-
-                this_set->last_line->next = cur_line;
-                this_set->last_line = cur_line;
-                cur_line->next = NULL;
-            } else {
-                // LRU, other line
-                prev_line = get_line(*this_set, type - 1);
-                cur_line = prev_line->next;
-
-                prev_line->next = cur_line->next;
-                this_set->last_line->next = cur_line;
-                this_set->last_line = cur_line;
-                cur_line->next = NULL;
-            }
+    for (int w = 0; w < threads; w++) {
+        pthread_join(shards[w].thread, NULL);
+        for (int c = 0; c < opts->cache_count; c++) {
+            csim_stats_t *total = &opts->caches[c].stats;
+            const csim_stats_t *part = &shards[w].stats[c];
+            total->hits = total->hits + part->hits;
+            total->misses = total->misses + part->misses;
+            total->evictions = total->evictions + part->evictions;
+            total->dirty_bytes = total->dirty_bytes + part->dirty_bytes;
+            total->dirty_evictions =
+                total->dirty_evictions + part->dirty_evictions;
+        }
+    }
+    free(shards);
+}
+
+void *shard_worker(void *arg) {
+    shard_t *shard = arg;
+    unsigned long head = 0;
+
+    while (true) {
+        unsigned long tail = __atomic_load_n(&shard->tail, __ATOMIC_ACQUIRE);
+        if (head == tail) {
+            // done is set after the last tail update, so check tail again
+            if (__atomic_load_n(&shard->done, __ATOMIC_ACQUIRE) &&
+                head == __atomic_load_n(&shard->tail, __ATOMIC_ACQUIRE))
+                return NULL;
+            sched_yield();
+            continue;
+        }
+
+        shard_batch_t *batch = &shard->ring[head % SHARD_RING];
+        for (int i = 0; i < batch->count; i++) {
+            const shard_item_t *item = &batch->items[i];
+            cache_access(&shard->caches[item->cache],
+                         &shard->stats[item->cache], item->set_num, item->tag,
+                         item->is_load, NULL);
+        }
+        head = head + 1;
+        __atomic_store_n(&shard->head, head, __ATOMIC_RELEASE);
+    }
+}
+
+void run_all_assoc(const csim_options_t *opts, trace_reader_t *reader) {
+    stackdist_t sd;
+    if (!stackdist_init(&sd, opts->s, opts->b, opts->E))
+        exit(1);
+
+    trace_access_t access;
+    while (trace_next(reader, &access))
+        stackdist_access(&sd, &access);
+    close_trace(reader);
+
+    // the victim order, and so the dirty bytes, differ for every E
+    for (int assoc = 1; assoc <= opts->E; assoc++) {
+        csim_stats_t stats;
+        stackdist_stats(&sd, assoc, &stats);
+        printf("E=%d hits:%ld misses:%ld evictions:%ld "
+               "dirty_bytes_in_cache:n/a dirty_bytes_evicted:n/a\n",
+               assoc, stats.hits, stats.misses, stats.evictions);
+    }
+    stackdist_free(&sd);
+}
+
+void run_hierarchy(const csim_options_t *opts, trace_reader_t *reader) {
+    hierarchy_t hier;
+    if (!hierarchy_load(&hier, opts->hierarchy_file, opts->kernel_name,
+                        opts->policy_name))
+        exit(1);
+
+    trace_access_t access;
+    while (trace_next(reader, &access))
+        hierarchy_access(&hier, &access);
+    close_trace(reader);
+
+    // .csim_results ends up holding the last level
+    for (int i = 0; i < hier.count; i++) {
+        printf("%s ", hier.levels[i].name);
+        printSummary(&hier.levels[i].cache.stats);
+    }
+    printf("memory reads:%ld writes:%ld\n", hier.memory_reads,
+           hier.memory_writes);
+    printf("AMAT:%.2f cycles\n", hierarchy_amat(&hier));
+    hierarchy_free(&hier);
+}
+
+void run_sampled(csim_options_t *opts, trace_reader_t *reader) {
+    int count = opts->cache_count;
+    sampler_t *samplers = xcalloc(count, sizeof(sampler_t));
+    for (int c = 0; c < count; c++) {
+        if (!sample_init(&samplers[c], &opts->caches[c],
+                         opts->set_ratio, opts->period, opts->warmup,
+                         opts->measure))
+            exit(1);
+    }
+
+    trace_access_t access;
+    while (trace_next(reader, &access)) {
+        for (int c = 0; c < count; c++)
+            sample_access(&samplers[c], &access);
+    }
+    close_trace(reader);
+
+    for (int c = 0; c < count; c++) {
+        cache_t *cache = samplers[c].cache;
+        csim_stats_t estimate, half;
+        sample_estimate(&samplers[c], &estimate, &half);
+        if (count > 1)
+            printf("s=%d E=%d b=%d ", cache->s, cache->E, cache->b);
+        printSummary(&estimate);
+
+        // the interval of each field, in printSummary() order
+        const char *names[] = {"hits", "misses", "evictions",
+                               "dirty_bytes_in_cache", "dirty_bytes_evicted"};
+        long widths[] = {half.hits, half.misses, half.evictions,
+                         half.dirty_bytes, half.dirty_evictions};
+        printf("%d%% interval", SAMPLE_CONFIDENCE);
+        for (int f = 0; f < 5; f++) {
+            if (widths[f] == SAMPLE_UNKNOWN)
+                printf(" %s:n/a", names[f]);
+            else
+                printf(" %s:+-%ld", names[f], widths[f]);
+        }
+        if (opts->set_ratio > 0)
+            printf(" (%ld of %ld sets)\n", sample_units(&samplers[c]),
+                   cache->total_sets);
+        else
+            printf(" (%ld windows of %ld accesses)\n",
+                   sample_units(&samplers[c]), opts->measure);
+        sample_free(&samplers[c]);
+        cache_free(cache);
+    }
+    free(samplers);
+}
+
+void run_profiled(csim_options_t *opts, trace_reader_t *reader) {
+    profile_t prof;
+    if (!profile_init(&prof, &opts->caches[0], opts->regions_file))
+        exit(1);
+
+    trace_access_t access;
+    while (trace_next(reader, &access))
+        profile_access(&prof, &access);
+    close_trace(reader);
+
+    bool written = profile_write(&prof, opts->profile_file);
+    profile_free(&prof);
+    if (!written)
+        exit(1);
+}
 
-            // update stats info
-            stats->hits = stats->hits + 1;
-            if (is_load == 0 && cur_line->dirty_bit == 0) {
-                stats->dirty_bytes = stats->dirty_bytes + total_bytes;
-                // update dirty_bit in the current line
-                cur_line->dirty_bit = 1;
+void run_prefetched(csim_options_t *opts, trace_reader_t *reader) {
+    prefetch_t *pfs = xcalloc(opts->cache_count, sizeof(prefetch_t));
+    for (int c = 0; c < opts->cache_count; c++) {
+        if (!prefetch_init(&pfs[c], &opts->caches[c], &opts->prefetch))
+            exit(1);
+    }
+
+    trace_access_t access;
+    long line_num = 0;
+    while (trace_next(reader, &access)) {
+        if (!access.continued)
+            line_num = line_num + 1;
+        for (int c = 0; c < opts->cache_count; c++) {
+            int type = prefetch_access(&pfs[c], &access);
+            for (int i = 0; i < opts->log_count; i++) {
+                long set_num, tag;
+                cache_locate(&opts->caches[c], access.addr, &set_num, &tag);
+                eventlog_record(&opts->logs[i], line_num, access.is_load,
+                                set_num, tag, type);
             }
         }
     }
-    fclose(stream);
-    printSummary(stats);
-    free_mem(sets, stats);
+
+    for (int c = 0; c < opts->cache_count; c++) {
+        opts->prefetch_stats[c] = pfs[c].stats;
+        prefetch_free(&pfs[c]);
+    }
+    free(pfs);
+}
+
+void simulate_access(csim_options_t *opts, cache_t *cache,
+                     const trace_access_t *access, int line_num) {
+    long tag, set_num;
+    cache_locate(cache, access->addr, &set_num, &tag);
+    int type = cache_access(cache, &cache->stats, set_num, tag,
+                            access->is_load, NULL);
+    for (int i = 0; i < opts->log_count; i++)
+        eventlog_record(&opts->logs[i], line_num, access->is_load, set_num,
+                        tag, type);
 }
 
-void set_global_values(int argc, char *argv[]) {
+void parse_options(csim_options_t *opts, int argc, char *argv[]) {
+    memset(opts, 0, sizeof(*opts));
+    opts->threads = 1;
+    opts->file_name = "";
+    opts->kernel_name = "auto";
+    opts->policy_name = "lru";
+
+    // -c caches are built once every option, including -k, is known
+    const char *configs[MAX_CONFIGS];
+    int config_count = 0;
+
     // Read values from command line
     int opt;
+    const char *optstring = "s:E:b:t:k:c:j:D:H:p:P:S:T:r:w:o:R:L:V:aBvh";
     /* looping over arguments */
-    while ((opt = getopt(argc, argv, "s:E:b:t:vh")) > 0) {
+    while ((opt = getopt(argc, argv, optstring)) > 0) {
         switch (opt) {
         case 'h':
-            help = 1;
+            opts->help = 1;
             break;
         case 'v':
-            verbose = 1;
+            opts->verbose = 1;
+            break;
+        case 'a':
+            opts->all_assoc = 1;
+            break;
+        case 'B':
+            opts->split_blocks = 1;
+            break;
+        case 'j':
+            opts->threads = atoi(optarg);
+            if (opts->threads < 1 || opts->threads > MAX_THREADS) {
+                printf("-j must be between 1 and %d\n", MAX_THREADS);
+                exit(1);
+            }
+            break;
+        case 'D':
+            opts->decoders = atoi(optarg);
+            if (opts->decoders < 1 || opts->decoders > TRACE_MAX_DECODERS) {
+                printf("-D must be between 1 and %d\n", TRACE_MAX_DECODERS);
+                exit(1);
+            }
             break;
         case 's':
-            s = atoi(optarg);
+            opts->s = atoi(optarg);
             break;
         case 'E':
-            E = atoi(optarg);
+            opts->E = atoi(optarg);
             break;
         case 'b':
-            b = atoi(optarg);
+            opts->b = atoi(optarg);
             break;
         case 't':
-            strcpy(file_name, optarg);
+            opts->file_name = optarg;
+            break;
+        case 'k':
+            opts->kernel_name = optarg;
+            break;
+        case 'p':
+            opts->policy_name = optarg;
+            opts->policy_given = 1;
+            break;
+        case 'P':
+            opts->prefetch_spec = optarg;
+            if (!prefetch_parse(&opts->prefetch, optarg)) {
+                printf("wrong prefetchers: %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'H':
+            opts->hierarchy_file = optarg;
+            break;
+        case 'r':
+            opts->restore_file = optarg;
+            break;
+        case 'w':
+            opts->save_file = optarg;
+            break;
+        case 'o':
+            opts->profile_file = optarg;
+            break;
+        case 'R':
+            opts->regions_file = optarg;
+            break;
+        case 'L':
+            opts->log_file = optarg;
+            break;
+        case 'V':
+            opts->log_filter = optarg;
+            break;
+        case 'S':
+            opts->set_ratio = atoi(optarg);
+            if (opts->set_ratio < 1) {
+                printf("-S needs a ratio of at least 1\n");
+                exit(1);
+            }
+            break;
+        case 'T':
+            if (sscanf(optarg, "%ld,%ld,%ld", &opts->period, &opts->warmup,
+                       &opts->measure) != 3 ||
+                opts->period <= 0) {
+                printf("-T needs period,warmup,measure\n");
+                exit(1);
+            }
+            break;
+        case 'c':
+            if (config_count == MAX_CONFIGS) {
+                printf("too many configurations\n");
+                exit(1);
+            }
+            configs[config_count] = optarg;
+            config_count = config_count + 1;
             break;
         default:
             printf("wrong argument\n");
@@ -245,111 +679,209 @@ void set_global_values(int argc, char *argv[]) {
         }
     }
 
-    // set other global values
-    total_sets = pow2(s);
-    total_bytes = pow2(b);
-    set_mask = total_sets - 1;
-}
+    bool sampled = opts->set_ratio > 0 || opts->period > 0;
+    bool logged = opts->verbose || opts->log_file;
+    if (opts->set_ratio > 0 && opts->period > 0) {
+        printf("-S and -T cannot be combined\n");
+        exit(1);
+    }
+    if (sampled && (opts->hierarchy_file || opts->all_assoc || logged)) {
+        printf("-S and -T do not work with -H, -a, -v or -L\n");
+        exit(1);
+    }
 
-void parsing_line(char *buffer, int *is_load, long *tag, long *set_num) {
-    long addr;
-    int byte_num;
-    char c;
-    sscanf(buffer, "%c %lx %*c %d", &c, &addr, &byte_num);
+    bool snapshots = opts->restore_file || opts->save_file;
+    if (snapshots && (sampled || opts->hierarchy_file || opts->all_assoc)) {
+        printf("-r and -w do not work with -H, -a, -S or -T\n");
+        exit(1);
+    }
+    if (opts->profile_file &&
+        (sampled || opts->hierarchy_file || opts->all_assoc ||
+         opts->restore_file || logged || config_count > 0)) {
+        printf("-o profiles one -s/-E/-b cache, without -H, -a, -S, -T, -r, "
+               "-v, -L or -c\n");
+        exit(1);
+    }
+    if (opts->regions_file && !opts->profile_file) {
+        printf("-R needs -o\n");
+        exit(1);
+    }
+    if (opts->log_file && (opts->hierarchy_file || opts->all_assoc)) {
+        printf("-L does not work with -H or -a\n");
+        exit(1);
+    }
+    if (opts->prefetch_spec && (sampled || opts->hierarchy_file ||
+                                opts->all_assoc || opts->profile_file)) {
+        printf("-P does not work with -H, -a, -S, -T or -o\n");
+        exit(1);
+    }
+    if (opts->split_blocks && opts->hierarchy_file) {
+        printf("-B does not work with -H\n");
+        exit(1);
+    }
+    if (opts->log_filter && !logged) {
+        printf("-V needs -v or -L\n");
+        exit(1);
+    }
+    if (logged && !opts->hierarchy_file && !opts->all_assoc)
+        open_logs(opts);
+    if (opts->restore_file) {
+        restore_caches(opts, configs, config_count);
+        return;
+    }
 
-    // set load
-    *is_load = 1;
-    if (c == 'S')
-        *is_load = 0;
+    // the hierarchy file describes every cache
+    if (opts->hierarchy_file)
+        return;
 
-    // set set_num
-    addr = addr >> b;
-    *set_num = addr & set_mask;
+    // with -a, -E is the largest associativity and no cache is built
+    if (opts->all_assoc == 1) {
+        if (opts->E <= 0) {
+            printf("-a needs -E\n");
+            exit(1);
+        }
+        if (strcmp(opts->policy_name, "lru") != 0) {
+            printf("-a only models LRU\n");
+            exit(1);
+        }
+        return;
+    }
 
-    // set tag
-    *tag = (addr >> s);
-}
+    for (int i = 0; i < config_count; i++)
+        add_config(opts, configs[i]);
 
-void *xcalloc(size_t num, size_t size) {
-    void *p = calloc(num, size);
-    if (p == NULL)
-        abort();
-    return p;
+    // -s/-E/-b describe one more cache, and the only one without -c
+    if (opts->E > 0 || opts->cache_count == 0)
+        add_cache(opts, opts->s, opts->E, opts->b);
 }
 
-int miss_type(set_t set, long set_num, long tag) {
-
-    int line_count = set.line_count;
-    // miss
-    if (line_count == 0)
-        return -1;
-
-    line_t *line = set.first_line;
-
-    for (int i = 0; i < line_count; i++) {
-        if (line->tag == tag) { // hit
-            return i;
+void split_blocks(csim_options_t *opts, trace_reader_t *reader) {
+    int b = opts->all_assoc ? opts->b : opts->caches[0].b;
+    for (int c = 1; c < opts->cache_count; c++) {
+        if (opts->caches[c].b != b) {
+            printf("-B needs every cache to have the same block size\n");
+            exit(1);
         }
-        line = line->next;
     }
-
-    // miss eviction
-    if (line_count == E)
-        return -2;
-
-    // miss
-    return -1;
+    trace_split_blocks(reader, b);
 }
 
-void init_line(line_t *line, long tag) {
-    line->tag = tag;
-    line->valid_bit = 1;
-    line->dirty_bit = 0;
+void add_config(csim_options_t *opts, const char *config) {
+    int cs, cE, cb;
+    if (sscanf(config, "%d,%d,%d", &cs, &cE, &cb) != 3) {
+        printf("wrong configuration: %s\n", config);
+        exit(1);
+    }
+    add_cache(opts, cs, cE, cb);
 }
 
-line_t *get_line(set_t set, int pos) {
-    line_t *line = set.first_line;
-    for (int i = 0; i < pos; i++)
-        line = line->next;
-    return line;
+void restore_caches(csim_options_t *opts, const char *configs[],
+                    int config_count) {
+    opts->cache_count = cache_load_snapshot(opts->restore_file, opts->caches,
+                                            MAX_CONFIGS, opts->kernel_name);
+    if (opts->cache_count < 0)
+        exit(1);
+
+    // without -p the snapshot alone names the policy
+    if (opts->policy_given) {
+        cache_policy_t policy;
+        unsigned long seed;
+        if (!cache_parse_policy(opts->policy_name, &policy, &seed)) {
+            printf("Unknown replacement policy: %s\n", opts->policy_name);
+            exit(1);
+        }
+        for (int i = 0; i < opts->cache_count; i++) {
+            const cache_t *cache = &opts->caches[i];
+            bool seeded = policy == CACHE_RANDOM || policy == CACHE_BRRIP;
+            if (cache->policy != policy || (seeded && cache->seed != seed)) {
+                printf("the policy of %s does not match -p %s\n",
+                       opts->restore_file, opts->policy_name);
+                exit(1);
+            }
+        }
+    }
+
+    // without -s/-E/-b or -c the snapshot alone describes the caches
+    int described = config_count + (opts->E > 0);
+    if (described == 0)
+        return;
+    bool match = described == opts->cache_count;
+    for (int i = 0; i < described && match; i++) {
+        int cs = opts->s, cE = opts->E, cb = opts->b;
+        if (i < config_count &&
+            sscanf(configs[i], "%d,%d,%d", &cs, &cE, &cb) != 3) {
+            printf("wrong configuration: %s\n", configs[i]);
+            exit(1);
+        }
+        const cache_t *cache = &opts->caches[i];
+        match = cache->s == cs && cache->E == cE && cache->b == cb;
+    }
+    if (!match) {
+        printf("the caches of %s do not match the command line\n",
+               opts->restore_file);
+        exit(1);
+    }
 }
 
-void free_mem(set_t *sets, csim_stats_t *stats) {
-
-    free(stats);
-
-    // free all lines
-    for (int i = 0; i < total_sets; i++) {
-        set_t set = sets[i];
-        if (set.line_count > 0) {
-            line_t *cur = set.first_line;
-            line_t *next = cur->next;
-            free(cur);
-            while (next) {
-                cur = next;
-                next = next->next;
-                free(cur);
-            }
+void open_logs(csim_options_t *opts) {
+    eventlog_filter_t filter;
+    eventlog_filter_all(&filter);
+    if (opts->log_filter && !eventlog_filter_parse(&filter, opts->log_filter)) {
+        printf("wrong event filter: %s\n", opts->log_filter);
+        exit(1);
+    }
+
+    // the text log writes around stdio, so nothing may be left buffered
+    if (opts->verbose) {
+        fflush(stdout);
+        if (!eventlog_open(&opts->logs[opts->log_count], STDOUT_FILENO, false,
+                           &filter))
+            exit(1);
+        opts->log_count = opts->log_count + 1;
+    }
+    if (opts->log_file) {
+        int fd = open(opts->log_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            printf("Error creating event log %s\n", opts->log_file);
+            exit(1);
         }
+        if (!eventlog_open(&opts->logs[opts->log_count], fd, true, &filter))
+            exit(1);
+        opts->log_count = opts->log_count + 1;
     }
+}
 
-    // free sets
-    free(sets);
+void close_logs(csim_options_t *opts) {
+    bool ok = true;
+    for (int i = 0; i < opts->log_count; i++) {
+        ok = eventlog_close(&opts->logs[i]) && ok;
+        if (opts->logs[i].fd != STDOUT_FILENO && close(opts->logs[i].fd) != 0)
+            ok = false;
+    }
+    opts->log_count = 0;
+    if (!ok)
+        exit(1);
 }
 
-int pow2(int index) {
-    if (index == 0)
-        return 1;
-    int half_res = pow2(index / 2);
-    if (index % 2 == 0)
-        return half_res * half_res;
-    else
-        return 2 * half_res * half_res;
+void add_cache(csim_options_t *opts, int s, int E, int b) {
+    if (opts->cache_count == MAX_CONFIGS) {
+        printf("too many configurations\n");
+        exit(1);
+    }
+    if (!cache_init(&opts->caches[opts->cache_count], s, E, b,
+                    opts->kernel_name, opts->policy_name))
+        exit(1);
+    opts->cache_count = opts->cache_count + 1;
 }
 
-FILE *file_open(char *file_name) {
-    FILE *stream = fopen(file_name, "r");
-    if (stream == NULL)
+void *xcalloc(size_t num, size_t size) {
+    void *p = calloc(num, size);
+    if (p == NULL)
         abort();
-    return stream;
-}
\ No newline at end of file
+    return p;
+}
+
+void close_trace(trace_reader_t *reader) {
+    if (!trace_close(reader))
+        exit(1);
+}
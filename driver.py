@@ -19,6 +19,7 @@ import argparse
 import hashlib
 import numbers
 import collections
+import concurrent.futures
 import json
 
 # Maximum scores for each part
@@ -94,8 +95,9 @@ def test_csim():
 
 
 def run_test_trans(cmd):
-    """Runs a test-trans command and returns the cycle count"""
-    print("Running %s" % cmd)
+    """Runs a test-trans command and returns the cycle count and the lines
+    to report for it"""
+    log = ["Running %s" % cmd]
     p = subprocess.Popen("%s | grep TEST_TRANS_RESULTS" % cmd,
                          shell=True, stdout=subprocess.PIPE, encoding='utf-8')
 
@@ -103,46 +105,46 @@ def run_test_trans(cmd):
         stdout_data = p.communicate(timeout=30)[0]
     except subprocess.TimeoutExpired:
         p.kill()
-        print("Error: command timed out.")
-        return None
+        log.append("Error: command timed out.")
+        return None, log
 
     if p.returncode != 0:
-        print("Error: return code indicates failure:", p.returncode)
-        return None
+        log.append("Error: return code indicates failure: %d" % p.returncode)
+        return None, log
 
     result = re.match(r'TEST_TRANS_RESULTS=(\d+):(\d+)', stdout_data)
     if result is None or result.group(1) != '1':
-        print("Error: return data indicates failure:", stdout_data)
-        return None
+        log.append("Error: return data indicates failure: %s" % stdout_data)
+        return None, log
 
-    return int(result.group(2))
+    return int(result.group(2)), log
 
 
 def test_trans():
     """Checks the correctness of the transpose functions"""
     print("Part B: Testing transpose function correctness")
 
+    # Every size runs at once; the performance runs only count if all of
+    # the correctness runs pass
+    cmds = ["./test-trans -s -M %d -N %d" % rc for rc in tests]
+    cmd32 = "./test-trans -s -M 32 -N 32"
+    cmd1024 = "./test-trans -s -M 1024 -N 1024 -l"
+    with concurrent.futures.ThreadPoolExecutor(len(cmds) + 2) as pool:
+        runs = list(pool.map(run_test_trans, cmds + [cmd32, cmd1024]))
+
     transOK = True
-    for rc in tests:
-        r = rc[0]
-        c = rc[1]
-        cmd = "./test-trans -s -M %d -N %d" % rc
-        cycles = run_test_trans(cmd)
+    for cycles, log in runs[:len(cmds)]:
+        print("\n".join(log))
         if cycles is None:
             transOK = False
 
     if transOK:
-        # 32x32 transpose
-        cmd = "./test-trans -s -M 32 -N 32"
-        cycles32 = run_test_trans(cmd)
-        if cycles32 is None:
-            transOK = False
-
-        # 1024x1024 transpose
-        cmd = "./test-trans -s -M 1024 -N 1024 -l"
-        cycles1024 = run_test_trans(cmd)
-        if cycles1024 is None:
-            transOK = False
+        for cycles, log in runs[len(cmds):]:
+            print("\n".join(log))
+            if cycles is None:
+                transOK = False
+        cycles32 = runs[len(cmds)][0]
+        cycles1024 = runs[len(cmds) + 1][0]
 
     if transOK:
         trans32_score = computeMissScore(
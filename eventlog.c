@@ -0,0 +1,188 @@
+/**
+ * @file eventlog.c
+ * @brief Buffered log of the outcome of every access, for csim -v and -L
+ */
+
+#define _POSIX_C_SOURCE 200809L /* for strdup */
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "eventlog.h"
+
+/** @brief Longest text event: four numbers and the fixed words */
+#define MAX_EVENT_TEXT 160
+
+static const char HEX_DIGITS[] = "0123456789abcdef";
+
+void eventlog_filter_all(eventlog_filter_t *filter) {
+    filter->set_lo = 0;
+    filter->set_hi = LONG_MAX;
+    filter->outcomes = EVENTLOG_HIT | EVENTLOG_MISS | EVENTLOG_EVICTION;
+}
+
+bool eventlog_filter_parse(eventlog_filter_t *filter, const char *spec) {
+    unsigned outcomes = 0;
+    char *copy = strdup(spec);
+    if (copy == NULL)
+        return false;
+
+    bool ok = true;
+    for (char *item = strtok(copy, ","); item && ok;
+         item = strtok(NULL, ",")) {
+        long lo, hi;
+        char end;
+        if (strcmp(item, "hit") == 0) {
+            outcomes |= EVENTLOG_HIT;
+        } else if (strcmp(item, "miss") == 0) {
+            outcomes |= EVENTLOG_MISS;
+        } else if (strcmp(item, "eviction") == 0) {
+            outcomes |= EVENTLOG_EVICTION;
+        } else if (sscanf(item, "set=%ld-%ld%c", &lo, &hi, &end) == 2 &&
+                   lo <= hi) {
+            filter->set_lo = lo;
+            filter->set_hi = hi;
+        } else if (sscanf(item, "set=%ld%c", &lo, &end) == 1) {
+            filter->set_lo = lo;
+            filter->set_hi = lo;
+        } else {
+            ok = false;
+        }
+    }
+    free(copy);
+
+    if (outcomes != 0)
+        filter->outcomes = outcomes;
+    return ok;
+}
+
+bool eventlog_open(eventlog_t *log, int fd, bool binary,
+                   const eventlog_filter_t *filter) {
+    memset(log, 0, sizeof(*log));
+    log->fd = fd;
+    log->binary = binary;
+    log->filter = *filter;
+    log->buffer = malloc(EVENTLOG_BUFFER_SIZE);
+    if (log->buffer == NULL) {
+        fprintf(stderr, "Failed to allocate the event log buffer\n");
+        return false;
+    }
+    if (binary) {
+        memcpy(log->buffer, EVENTLOG_MAGIC, sizeof(EVENTLOG_MAGIC) - 1);
+        log->len = sizeof(EVENTLOG_MAGIC) - 1;
+    }
+    return true;
+}
+
+bool eventlog_flush(eventlog_t *log) {
+    size_t done = 0;
+    while (done < log->len) {
+        ssize_t n = write(log->fd, log->buffer + done, log->len - done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            fprintf(stderr, "Error writing the event log: %s\n",
+                    strerror(errno));
+            log->len = 0;
+            return false;
+        }
+        done = done + n;
+    }
+    log->len = 0;
+    return true;
+}
+
+/**
+ * @brief Append a string, return the new end
+ */
+static char *put_text(char *p, const char *text, size_t len) {
+    memcpy(p, text, len);
+    return p + len;
+}
+
+/**
+ * @brief Append value in decimal, return the new end
+ */
+static char *put_dec(char *p, long value) {
+    char digits[24];
+    int n = 0;
+    unsigned long v = value < 0 ? -(unsigned long)value : (unsigned long)value;
+    if (value < 0)
+        *p++ = '-';
+    do {
+        digits[n++] = (char)('0' + v % 10);
+        v = v / 10;
+    } while (v != 0);
+    while (n > 0)
+        *p++ = digits[--n];
+    return p;
+}
+
+/**
+ * @brief Append value in lowercase hex, as %lx would, return the new end
+ */
+static char *put_hex(char *p, unsigned long value) {
+    char digits[16];
+    int n = 0;
+    do {
+        digits[n++] = HEX_DIGITS[value & 0xf];
+        value = value >> 4;
+    } while (value != 0);
+    while (n > 0)
+        *p++ = digits[--n];
+    return p;
+}
+
+#define PUT_LITERAL(p, text) put_text(p, text, sizeof(text) - 1)
+
+void eventlog_record(eventlog_t *log, long line_num, bool is_load,
+                     long set_num, long tag, int type) {
+    eventlog_outcome_t outcome = type >= 0 ? EVENTLOG_HIT
+                                 : type == CACHE_COLD_MISS ? EVENTLOG_MISS
+                                                           : EVENTLOG_EVICTION;
+    const eventlog_filter_t *filter = &log->filter;
+    if ((filter->outcomes & outcome) == 0 || set_num < filter->set_lo ||
+        set_num > filter->set_hi)
+        return;
+
+    size_t room = log->binary ? sizeof(eventlog_record_t) : MAX_EVENT_TEXT;
+    if (EVENTLOG_BUFFER_SIZE - log->len < room)
+        eventlog_flush(log);
+
+    if (log->binary) {
+        eventlog_record_t record = {(uint64_t)line_num, (uint64_t)tag,
+                                    (uint32_t)set_num, is_load, outcome};
+        memcpy(log->buffer + log->len, &record, sizeof(record));
+        log->len = log->len + sizeof(record);
+        return;
+    }
+
+    char *p = log->buffer + log->len;
+    p = PUT_LITERAL(p, "line_num = ");
+    p = put_dec(p, line_num);
+    p = PUT_LITERAL(p, ",is_load = ");
+    *p++ = is_load ? '1' : '0';
+    p = PUT_LITERAL(p, ", set_num = ");
+    p = put_dec(p, set_num);
+    p = PUT_LITERAL(p, ", tag = ");
+    p = put_hex(p, (unsigned long)tag);
+    if (outcome == EVENTLOG_HIT)
+        p = PUT_LITERAL(p, " hit\n");
+    else if (outcome == EVENTLOG_MISS)
+        p = PUT_LITERAL(p, " miss\n");
+    else
+        p = PUT_LITERAL(p, " miss eviction\n");
+    log->len = p - log->buffer;
+}
+
+bool eventlog_close(eventlog_t *log) {
+    bool ok = eventlog_flush(log);
+    free(log->buffer);
+    log->buffer = NULL;
+    return ok;
+}
@@ -0,0 +1,99 @@
+/**
+ * @file eventlog.h
+ * @brief Buffered log of the outcome of every access, for csim -v and -L
+ *
+ * Events are formatted into a large buffer by hand and written out with
+ * write() once it fills, so logging costs a few stores per access instead
+ * of several printf() calls. An eventlog_t owns its buffer; use one per
+ * thread.
+ *
+ * The text form is the line csim -v has always printed:
+ *
+ *     line_num = <n>,is_load = <0|1>, set_num = <set>, tag = <hex> <outcome>
+ *
+ * where the outcome is "hit", "miss" or "miss eviction". The binary form
+ * starts with EVENTLOG_MAGIC and has one eventlog_record_t per event, in
+ * host byte order.
+ *
+ * A filter, given as a comma-separated list, keeps events by set and
+ * outcome: "set=<lo>-<hi>" or "set=<n>" keeps only those sets, and naming
+ * any of "hit", "miss" or "eviction" keeps only those outcomes.
+ */
+
+#ifndef CACHELAB_EVENTLOG_H
+#define CACHELAB_EVENTLOG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/** @brief First bytes of a binary event log */
+#define EVENTLOG_MAGIC "CSIMEVT1"
+
+/** @brief Bytes buffered before they are written */
+#define EVENTLOG_BUFFER_SIZE (1 << 20)
+
+/** @brief Outcomes of an access, as bits of eventlog_filter_t.outcomes */
+typedef enum {
+    EVENTLOG_HIT = 1,
+    EVENTLOG_MISS = 2,     /* a miss that filled a free way */
+    EVENTLOG_EVICTION = 4, /* a miss that evicted a line */
+} eventlog_outcome_t;
+
+/**
+ * @brief Which events are logged
+ */
+typedef struct {
+    long set_lo;
+    long set_hi;
+    unsigned outcomes; /* mask of eventlog_outcome_t */
+} eventlog_filter_t;
+
+/**
+ * @brief One event of the binary form
+ */
+typedef struct {
+    uint64_t line_num;
+    uint64_t tag;
+    uint32_t set_num;
+    uint8_t is_load;
+    uint8_t outcome; /* an eventlog_outcome_t */
+    uint8_t pad[2];
+} eventlog_record_t;
+
+/**
+ * @brief A log being written
+ */
+typedef struct {
+    int fd;
+    bool binary;
+    eventlog_filter_t filter;
+    char *buffer;
+    size_t len; /* bytes waiting in buffer */
+} eventlog_t;
+
+/** @brief A filter that keeps every event */
+void eventlog_filter_all(eventlog_filter_t *filter);
+
+/** @brief Narrow filter by the list spec, see eventlog.h */
+bool eventlog_filter_parse(eventlog_filter_t *filter, const char *spec);
+
+/**
+ * @brief Start a log written to fd, in the binary form if binary, that
+ * keeps the events filter accepts
+ */
+bool eventlog_open(eventlog_t *log, int fd, bool binary,
+                   const eventlog_filter_t *filter);
+
+/**
+ * @brief Log one access. type is the cache_access() result.
+ */
+void eventlog_record(eventlog_t *log, long line_num, bool is_load,
+                     long set_num, long tag, int type);
+
+/** @brief Write what is buffered */
+bool eventlog_flush(eventlog_t *log);
+
+/** @brief Flush and release the buffer; the descriptor stays open */
+bool eventlog_close(eventlog_t *log);
+
+#endif /* CACHELAB_EVENTLOG_H */
@@ -0,0 +1,259 @@
+/**
+ * @file hierarchy.c
+ * @brief Multi-level cache hierarchy built from cache_t levels
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "hierarchy.h"
+
+/** @brief Longest configuration line */
+#define LINE_SIZE 256
+
+/**
+ * @brief Parse one configuration line into hier
+ */
+static bool parse_directive(hierarchy_t *hier, const char *line,
+                            const char *kernel, const char *policy) {
+    char word[16], name[16], replacement[32];
+    int s, E, b, cycles;
+
+    if (sscanf(line, "%15s", word) != 1 || word[0] == '#')
+        return true;
+
+    if (strcmp(word, "policy") == 0) {
+        if (sscanf(line, "%*s %15s", name) != 1)
+            return false;
+        if (strcmp(name, "inclusive") == 0)
+            hier->policy = HIERARCHY_INCLUSIVE;
+        else if (strcmp(name, "exclusive") == 0)
+            hier->policy = HIERARCHY_EXCLUSIVE;
+        else if (strcmp(name, "nine") == 0)
+            hier->policy = HIERARCHY_NINE;
+        else
+            return false;
+        return true;
+    }
+
+    if (strcmp(word, "memory") == 0)
+        return sscanf(line, "%*s %d", &hier->memory_cycles) == 1;
+
+    if (strcmp(word, "level") == 0) {
+        int fields = sscanf(line, "%*s %15s %d %d %d %d %31s", name, &s, &E, &b,
+                            &cycles, replacement);
+        if (fields < 5 || s < 0 || E <= 0 || b < 0)
+            return false;
+        if (fields == 6)
+            policy = replacement;
+        if (hier->count == HIERARCHY_MAX_LEVELS) {
+            fprintf(stderr, "At most %d levels are supported\n",
+                    HIERARCHY_MAX_LEVELS);
+            return false;
+        }
+        if (hier->count > 0 && hier->levels[0].cache.b != b) {
+            fprintf(stderr, "Every level must use the same block size\n");
+            return false;
+        }
+
+        hierarchy_level_t *level = &hier->levels[hier->count];
+        strcpy(level->name, name);
+        level->hit_cycles = cycles;
+        if (!cache_init(&level->cache, s, E, b, kernel, policy))
+            return false;
+        hier->count = hier->count + 1;
+        return true;
+    }
+    return false;
+}
+
+bool hierarchy_load(hierarchy_t *hier, const char *file_name,
+                    const char *kernel, const char *policy) {
+    memset(hier, 0, sizeof(*hier));
+    hier->policy = HIERARCHY_NINE;
+    hier->memory_cycles = MISS_CYCLES;
+
+    FILE *fp = fopen(file_name, "r");
+    if (fp == NULL) {
+        fprintf(stderr, "Error opening hierarchy file %s\n", file_name);
+        return false;
+    }
+
+    char line[LINE_SIZE];
+    int line_num = 0;
+    while (fgets(line, sizeof(line), fp)) {
+        line_num = line_num + 1;
+        if (!parse_directive(hier, line, kernel, policy)) {
+            fprintf(stderr, "%s:%d: invalid directive: %s", file_name,
+                    line_num, line);
+            fclose(fp);
+            hierarchy_free(hier);
+            return false;
+        }
+    }
+    fclose(fp);
+
+    if (hier->count == 0) {
+        fprintf(stderr, "%s: no cache levels\n", file_name);
+        return false;
+    }
+    return true;
+}
+
+static void writeback(hierarchy_t *hier, int level, unsigned long addr);
+
+/**
+ * @brief Move a line evicted by level down or out of the hierarchy
+ */
+static void evict(hierarchy_t *hier, int level, unsigned long addr,
+                  bool dirty) {
+    if (hier->policy == HIERARCHY_INCLUSIVE) {
+        // the copies above go too, and their data with the victim
+        for (int i = 0; i < level; i++) {
+            cache_t *upper = &hier->levels[i].cache;
+            long set_num, tag;
+            bool upper_dirty;
+            cache_locate(upper, addr, &set_num, &tag);
+            if (cache_invalidate(upper, &upper->stats, set_num, tag,
+                                 &upper_dirty) &&
+                upper_dirty) {
+                upper->stats.dirty_evictions =
+                    upper->stats.dirty_evictions + upper->total_bytes;
+                dirty = true;
+            }
+        }
+    }
+
+    if (hier->policy == HIERARCHY_EXCLUSIVE) {
+        // victims, clean or dirty, fill the level below
+        for (level = level + 1; level < hier->count; level++) {
+            cache_t *cache = &hier->levels[level].cache;
+            long set_num, tag;
+            cache_victim_t victim;
+            cache_locate(cache, addr, &set_num, &tag);
+            if (!cache_fill(cache, &cache->stats, set_num, tag, dirty,
+                            &victim))
+                return;
+            addr = cache_address(cache, set_num, victim.tag);
+            dirty = victim.dirty;
+        }
+        if (dirty)
+            hier->memory_writes = hier->memory_writes + 1;
+        return;
+    }
+
+    if (dirty)
+        writeback(hier, level + 1, addr);
+}
+
+/**
+ * @brief Write a dirty block into level, allocating without a fetch
+ */
+static void writeback(hierarchy_t *hier, int level, unsigned long addr) {
+    if (level == hier->count) {
+        hier->memory_writes = hier->memory_writes + 1;
+        return;
+    }
+
+    cache_t *cache = &hier->levels[level].cache;
+    long set_num, tag;
+    cache_victim_t victim;
+    cache_locate(cache, addr, &set_num, &tag);
+    if (cache_access(cache, &cache->stats, set_num, tag, false, &victim) ==
+        CACHE_CAPACITY_MISS)
+        evict(hier, level, cache_address(cache, set_num, victim.tag),
+              victim.dirty);
+}
+
+/**
+ * @brief Demand access at level for the inclusive and nine policies,
+ * fetching the block from below on a miss
+ */
+static void fetch(hierarchy_t *hier, int level, unsigned long addr,
+                  bool is_load) {
+    if (level == hier->count) {
+        hier->memory_reads = hier->memory_reads + 1;
+        return;
+    }
+
+    hierarchy_level_t *current = &hier->levels[level];
+    cache_t *cache = &current->cache;
+    long set_num, tag;
+    cache_victim_t victim;
+    current->lookups = current->lookups + 1;
+    cache_locate(cache, addr, &set_num, &tag);
+
+    int type =
+        cache_access(cache, &cache->stats, set_num, tag, is_load, &victim);
+    if (type >= 0)
+        return;
+    if (type == CACHE_CAPACITY_MISS)
+        evict(hier, level, cache_address(cache, set_num, victim.tag),
+              victim.dirty);
+    fetch(hier, level + 1, addr, true);
+}
+
+/**
+ * @brief Demand access for the exclusive policy
+ */
+static void fetch_exclusive(hierarchy_t *hier, unsigned long addr,
+                            bool is_load) {
+    cache_t *top = &hier->levels[0].cache;
+    long set_num, tag;
+    hier->levels[0].lookups = hier->levels[0].lookups + 1;
+    cache_locate(top, addr, &set_num, &tag);
+    if (cache_lookup(top, set_num, tag) >= 0) {
+        cache_access(top, &top->stats, set_num, tag, is_load, NULL);
+        return;
+    }
+    top->stats.misses = top->stats.misses + 1;
+
+    // take the block out of the first level below that has it
+    bool dirty = !is_load;
+    int level;
+    for (level = 1; level < hier->count; level++) {
+        hierarchy_level_t *current = &hier->levels[level];
+        cache_t *cache = &current->cache;
+        long lower_set, lower_tag;
+        bool lower_dirty;
+        current->lookups = current->lookups + 1;
+        cache_locate(cache, addr, &lower_set, &lower_tag);
+        if (cache_invalidate(cache, &cache->stats, lower_set, lower_tag,
+                             &lower_dirty)) {
+            cache->stats.hits = cache->stats.hits + 1;
+            dirty = dirty || lower_dirty;
+            break;
+        }
+        cache->stats.misses = cache->stats.misses + 1;
+    }
+    if (level == hier->count)
+        hier->memory_reads = hier->memory_reads + 1;
+
+    cache_victim_t victim;
+    if (cache_fill(top, &top->stats, set_num, tag, dirty, &victim))
+        evict(hier, 0, cache_address(top, set_num, victim.tag), victim.dirty);
+}
+
+void hierarchy_access(hierarchy_t *hier, const trace_access_t *access) {
+    if (hier->policy == HIERARCHY_EXCLUSIVE)
+        fetch_exclusive(hier, access->addr, access->is_load);
+    else
+        fetch(hier, 0, access->addr, access->is_load);
+}
+
+double hierarchy_amat(const hierarchy_t *hier) {
+    if (hier->levels[0].lookups == 0)
+        return 0;
+
+    // every demand access pays the hit time of each level it reaches
+    double cycles = (double)hier->memory_reads * hier->memory_cycles;
+    for (int i = 0; i < hier->count; i++)
+        cycles += (double)hier->levels[i].lookups * hier->levels[i].hit_cycles;
+    return cycles / hier->levels[0].lookups;
+}
+
+void hierarchy_free(hierarchy_t *hier) {
+    for (int i = 0; i < hier->count; i++)
+        cache_free(&hier->levels[i].cache);
+    hier->count = 0;
+}
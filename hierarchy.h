@@ -0,0 +1,85 @@
+/**
+ * @file hierarchy.h
+ * @brief Multi-level cache hierarchy built from cache_t levels
+ *
+ * Level 0 sees the trace. A miss in one level fetches the block from the
+ * next one and a dirty line written back by a level is a store to the next
+ * one; past the last level is memory. The inclusion policy decides where a
+ * block lives:
+ *
+ *   - inclusive: every level holds a superset of the levels above it, and
+ *     evicting a block also invalidates it above
+ *   - exclusive: a block lives in at most one level; a hit below moves it
+ *     up and every evicted line, clean or dirty, moves one level down
+ *   - nine (non-inclusive non-exclusive): fills go to every level on the
+ *     way up and evictions never reach other levels
+ *
+ * All levels must use the same block size.
+ *
+ * The configuration file has one directive per line, '#' starts a comment:
+ *
+ *     policy inclusive|exclusive|nine
+ *     memory <cycles>
+ *     level <name> <s> <E> <b> <hit cycles> [<replacement policy>]
+ *
+ * with the levels listed from the one closest to the processor.
+ */
+
+#ifndef CACHELAB_HIERARCHY_H
+#define CACHELAB_HIERARCHY_H
+
+#include <stdbool.h>
+
+#include "cache.h"
+#include "trace.h"
+
+/** @brief Most levels a hierarchy can have */
+#define HIERARCHY_MAX_LEVELS 8
+
+typedef enum {
+    HIERARCHY_INCLUSIVE,
+    HIERARCHY_EXCLUSIVE,
+    HIERARCHY_NINE
+} hierarchy_policy_t;
+
+/**
+ * @brief One level; cache.stats counts every access it sees, including
+ * writebacks from above
+ */
+typedef struct {
+    char name[16];
+    cache_t cache;
+    int hit_cycles;
+    long lookups; /* demand fetches that reached this level */
+} hierarchy_level_t;
+
+/**
+ * @brief A whole hierarchy and the traffic that reached memory
+ */
+typedef struct {
+    hierarchy_policy_t policy;
+    int count;
+    hierarchy_level_t levels[HIERARCHY_MAX_LEVELS];
+    int memory_cycles;
+    long memory_reads;  /* blocks fetched from memory */
+    long memory_writes; /* dirty blocks written to memory */
+} hierarchy_t;
+
+/**
+ * @brief Build the hierarchy described by the configuration file, using the
+ * tag-compare kernel named kernel for every level and the replacement
+ * policy named policy for levels that do not name their own
+ */
+bool hierarchy_load(hierarchy_t *hier, const char *file_name,
+                    const char *kernel, const char *policy);
+
+/** @brief Run one access of the trace through the hierarchy */
+void hierarchy_access(hierarchy_t *hier, const trace_access_t *access);
+
+/** @brief Average memory access time of the demand accesses, in cycles */
+double hierarchy_amat(const hierarchy_t *hier);
+
+/** @brief Release every level */
+void hierarchy_free(hierarchy_t *hier);
+
+#endif /* CACHELAB_HIERARCHY_H */
@@ -0,0 +1,205 @@
+/**
+ * @file prefetch.c
+ * @brief Hardware prefetchers in front of one simulated cache
+ */
+
+#define _POSIX_C_SOURCE 200809L /* for strdup */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "prefetch.h"
+
+/** @brief Largest degree a spec can give */
+#define MAX_DEGREE 64
+
+#define HASH_MULTIPLIER 0x9E3779B97F4A7C15UL
+
+bool prefetch_parse(prefetch_config_t *config, const char *spec) {
+    memset(config, 0, sizeof(*config));
+    char *copy = strdup(spec);
+    if (copy == NULL)
+        return false;
+
+    bool ok = true;
+    for (char *item = strtok(copy, ","); item && ok;
+         item = strtok(NULL, ",")) {
+        int degree = 1;
+        char *colon = strchr(item, ':');
+        if (colon) {
+            char end;
+            *colon = '\0';
+            ok = sscanf(colon + 1, "%d%c", &degree, &end) == 1 &&
+                 degree >= 1 && degree <= MAX_DEGREE;
+        }
+        if (strcmp(item, "next") == 0)
+            config->next_line = degree;
+        else if (strcmp(item, "stride") == 0)
+            config->stride = degree;
+        else if (strcmp(item, "stream") == 0)
+            config->stream = degree;
+        else
+            ok = false;
+    }
+    free(copy);
+    return ok;
+}
+
+bool prefetch_init(prefetch_t *pf, cache_t *cache,
+                   const prefetch_config_t *config) {
+    memset(pf, 0, sizeof(*pf));
+    pf->cache = cache;
+    pf->config = *config;
+    pf->ready = calloc(cache->total_sets * cache->E, sizeof(long));
+    pf->polluted = calloc(PREFETCH_FILTER_SIZE, sizeof(unsigned long));
+    if (pf->ready == NULL || pf->polluted == NULL) {
+        fprintf(stderr, "Failed to allocate the prefetcher\n");
+        prefetch_free(pf);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Slot of block in the filter of blocks prefetches evicted
+ */
+static long filter_slot(unsigned long block) {
+    return (long)((block * HASH_MULTIPLIER) >> 32) & (PREFETCH_FILTER_SIZE - 1);
+}
+
+/**
+ * @brief Prefetch block into the cache unless it is already there
+ */
+static void issue(prefetch_t *pf, unsigned long block) {
+    cache_t *cache = pf->cache;
+    long set_num, tag;
+    cache_locate(cache, block << cache->b, &set_num, &tag);
+    if (cache_lookup(cache, set_num, tag) >= 0)
+        return;
+
+    cache_victim_t victim;
+    bool evicted =
+        cache_fill(cache, &cache->stats, set_num, tag, false, &victim);
+    long *ready = &pf->ready[set_num * cache->E +
+                             cache_lookup(cache, set_num, tag)];
+
+    // the new line took the victim's way, so *ready still describes it;
+    // evicting an unused prefetch does not pollute
+    if (evicted && *ready == 0) {
+        unsigned long evicted_block =
+            cache_address(cache, set_num, victim.tag) >> cache->b;
+        pf->polluted[filter_slot(evicted_block)] = evicted_block + 1;
+    }
+    *ready = pf->now + PREFETCH_LATENCY + 1;
+    pf->stats.issued = pf->stats.issued + 1;
+}
+
+/**
+ * @brief Train the stride prefetcher on every demand access
+ */
+static void run_stride(prefetch_t *pf, unsigned long addr) {
+    unsigned long region = addr >> PREFETCH_REGION_BITS;
+    prefetch_stride_t *entry =
+        &pf->strides[region & (PREFETCH_STRIDE_ENTRIES - 1)];
+    if (entry->region != region + 1) {
+        entry->region = region + 1;
+        entry->last_addr = addr;
+        entry->stride = 0;
+        entry->confirmed = false;
+        return;
+    }
+
+    long stride = (long)(addr - entry->last_addr);
+    entry->confirmed = stride != 0 && stride == entry->stride;
+    entry->stride = stride;
+    entry->last_addr = addr;
+    if (!entry->confirmed)
+        return;
+    for (int i = 1; i <= pf->config.stride; i++)
+        issue(pf, (addr + (unsigned long)(i * stride)) >> pf->cache->b);
+}
+
+/**
+ * @brief Advance the stream block belongs to, or start one on a miss
+ */
+static void run_stream(prefetch_t *pf, unsigned long block, bool miss) {
+    int degree = pf->config.stream;
+    int oldest = 0;
+    for (int i = 0; i < PREFETCH_STREAMS; i++) {
+        prefetch_stream_t *stream = &pf->streams[i];
+        if (stream->valid && block >= stream->next &&
+            block <= stream->next + degree) {
+            stream->next = block + 1;
+            stream->last_use = pf->now;
+            unsigned long from = stream->ahead > block ? stream->ahead : block;
+            for (unsigned long b = from + 1; b <= block + degree; b++)
+                issue(pf, b);
+            if (block + degree > stream->ahead)
+                stream->ahead = block + degree;
+            return;
+        }
+        if (!stream->valid || (pf->streams[oldest].valid &&
+                               stream->last_use < pf->streams[oldest].last_use))
+            oldest = i;
+    }
+
+    // the next miss on block + 1 confirms the new stream
+    if (miss) {
+        prefetch_stream_t *stream = &pf->streams[oldest];
+        stream->valid = true;
+        stream->next = block + 1;
+        stream->ahead = block;
+        stream->last_use = pf->now;
+    }
+}
+
+int prefetch_access(prefetch_t *pf, const trace_access_t *access) {
+    cache_t *cache = pf->cache;
+    unsigned long block = access->addr >> cache->b;
+    long set_num, tag;
+    cache_locate(cache, access->addr, &set_num, &tag);
+    pf->now = pf->now + 1;
+
+    int type = cache_access(cache, &cache->stats, set_num, tag,
+                            access->is_load, NULL);
+    bool trigger = type < 0;
+    if (type >= 0) {
+        long *ready = &pf->ready[set_num * cache->E + type];
+        if (*ready != 0) {
+            if (pf->now < *ready - 1)
+                pf->stats.late = pf->stats.late + 1;
+            else
+                pf->stats.useful = pf->stats.useful + 1;
+            *ready = 0;
+
+            // using a prefetched line keeps the prefetchers going
+            trigger = true;
+        }
+    } else {
+        // the fill may have taken the way of an unused prefetch
+        pf->ready[set_num * cache->E + cache_lookup(cache, set_num, tag)] = 0;
+        long slot = filter_slot(block);
+        if (pf->polluted[slot] == block + 1) {
+            pf->stats.polluting = pf->stats.polluting + 1;
+            pf->polluted[slot] = 0;
+        }
+    }
+
+    if (pf->config.stride > 0)
+        run_stride(pf, access->addr);
+    if (!trigger)
+        return type;
+    for (int i = 1; i <= pf->config.next_line; i++)
+        issue(pf, block + i);
+    if (pf->config.stream > 0)
+        run_stream(pf, block, type < 0);
+    return type;
+}
+
+void prefetch_free(prefetch_t *pf) {
+    free(pf->ready);
+    free(pf->polluted);
+    pf->ready = NULL;
+    pf->polluted = NULL;
+}
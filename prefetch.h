@@ -0,0 +1,130 @@
+/**
+ * @file prefetch.h
+ * @brief Hardware prefetchers in front of one simulated cache
+ *
+ * Three prefetchers can run side by side, each with a degree N, the number
+ * of blocks it fetches ahead:
+ *
+ *   - next-line: a demand miss, or the first use of a prefetched line,
+ *     fetches the N blocks after it
+ *   - stride: without program counters, accesses are grouped by the
+ *     2^PREFETCH_REGION_BITS-byte region they fall in. Once two accesses in
+ *     a row of a region move by the same stride, the next N strides ahead
+ *     are fetched.
+ *   - stream: up to PREFETCH_STREAMS ascending streams, each started by a
+ *     miss. A trigger within N blocks past the block a stream expects
+ *     advances it and keeps it N blocks ahead of the demand accesses.
+ *
+ * A prefetch of a block that is already cached is dropped. Otherwise the
+ * block is filled through cache_fill(), the path demand misses take, and
+ * counts as issued. It arrives PREFETCH_LATENCY accesses later. The first
+ * demand access to a prefetched line is useful if the line has arrived and
+ * late if it has not. That access still counts as a hit. A demand miss on
+ * a block that a prefetch fill evicted counts as polluting. Prefetch fills
+ * that evict count in the evictions and dirty bytes of the cache, but not
+ * in its hits or misses.
+ *
+ * A spec is a comma-separated list of "next", "stride" and "stream", each
+ * optionally followed by ":N". N defaults to 1.
+ */
+
+#ifndef CACHELAB_PREFETCH_H
+#define CACHELAB_PREFETCH_H
+
+#include <stdbool.h>
+
+#include "cache.h"
+#include "cachelab.h"
+#include "trace.h"
+
+/** @brief Accesses a prefetch takes to arrive: one miss, counted in hits */
+#define PREFETCH_LATENCY (MISS_CYCLES / HIT_CYCLES)
+
+/** @brief log2 of the size of the regions the stride prefetcher tracks */
+#define PREFETCH_REGION_BITS 12
+
+/** @brief Regions the stride prefetcher tracks, a power of two */
+#define PREFETCH_STRIDE_ENTRIES 64
+
+/** @brief Streams the stream prefetcher tracks */
+#define PREFETCH_STREAMS 8
+
+/** @brief Blocks evicted by prefetches that are remembered, a power of two */
+#define PREFETCH_FILTER_SIZE 4096
+
+/**
+ * @brief Degrees of the three prefetchers, 0 for those that are off
+ */
+typedef struct {
+    int next_line;
+    int stride;
+    int stream;
+} prefetch_config_t;
+
+/**
+ * @brief What the prefetchers of one cache did
+ */
+typedef struct {
+    long issued;
+    long useful;
+    long late;
+    long polluting;
+} prefetch_stats_t;
+
+/**
+ * @brief Last access and stride seen in one region
+ */
+typedef struct {
+    unsigned long region; /* region number + 1, 0 if unused */
+    unsigned long last_addr;
+    long stride;
+    bool confirmed; /* the last two strides were equal */
+} prefetch_stride_t;
+
+/**
+ * @brief An ascending stream
+ */
+typedef struct {
+    bool valid;
+    unsigned long next;  /* block the demand accesses should reach next */
+    unsigned long ahead; /* last block prefetched */
+    long last_use;
+} prefetch_stream_t;
+
+/**
+ * @brief State of the prefetchers of one cache
+ */
+typedef struct {
+    cache_t *cache;
+    prefetch_config_t config;
+    prefetch_stats_t stats;
+    long now; /* demand accesses so far */
+
+    /* per line, 1 + the access its prefetch arrives at while it is unused,
+       otherwise 0 */
+    long *ready;
+
+    /* direct-mapped, block + 1 of lines prefetch fills evicted */
+    unsigned long *polluted;
+
+    prefetch_stride_t strides[PREFETCH_STRIDE_ENTRIES];
+    prefetch_stream_t streams[PREFETCH_STREAMS];
+} prefetch_t;
+
+/** @brief Parse a prefetcher spec, see prefetch.h */
+bool prefetch_parse(prefetch_config_t *config, const char *spec);
+
+/** @brief Put the prefetchers of config in front of cache */
+bool prefetch_init(prefetch_t *pf, cache_t *cache,
+                   const prefetch_config_t *config);
+
+/**
+ * @brief Run one demand access through the cache, then let the prefetchers
+ * react to it. Return the cache_access() result.
+ */
+int prefetch_access(prefetch_t *pf, const trace_access_t *access);
+
+/** @brief Release the per-line state, but not the cache */
+void prefetch_free(prefetch_t *pf);
+
+#endif /* CACHELAB_PREFETCH_H */
@@ -0,0 +1,280 @@
+/**
+ * @file profile.c
+ * @brief Per-set and per-region miss attribution of one cache
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "profile.h"
+
+/** @brief Longest line of a regions file */
+#define LINE_SIZE 256
+
+/** @brief Initial number of slots of the seen-block set, a power of two */
+#define SEEN_INITIAL_CAP 1024
+
+#define HASH_MULTIPLIER 0x9E3779B97F4A7C15UL
+
+/** @brief Names of the columns of the report, in profile_counts_t order */
+static const char *COLUMNS[] = {"accesses", "hits",     "misses",  "evictions",
+                                "cold",     "capacity", "conflict"};
+
+#define COLUMN_COUNT 7
+
+/**
+ * @brief Read the regions of a regions file, see profile.h
+ */
+static bool load_regions(profile_t *prof, const char *file_name) {
+    FILE *fp = fopen(file_name, "r");
+    if (fp == NULL) {
+        fprintf(stderr, "Error opening regions file %s\n", file_name);
+        return false;
+    }
+
+    char line[LINE_SIZE];
+    int line_num = 0;
+    while (fgets(line, sizeof(line), fp)) {
+        line_num = line_num + 1;
+        char word[2];
+        if (sscanf(line, "%1s", word) != 1 || word[0] == '#')
+            continue;
+
+        profile_region_t *region = &prof->regions[prof->region_count];
+        if (prof->region_count == PROFILE_MAX_REGIONS ||
+            sscanf(line, "%31s %lx %lx", region->name, &region->start,
+                   &region->end) != 3 ||
+            region->end < region->start) {
+            fprintf(stderr, "%s:%d: invalid region: %s", file_name, line_num,
+                    line);
+            fclose(fp);
+            return false;
+        }
+        prof->region_count = prof->region_count + 1;
+    }
+    fclose(fp);
+    return true;
+}
+
+bool profile_init(profile_t *prof, cache_t *cache, const char *regions_file) {
+    memset(prof, 0, sizeof(*prof));
+    prof->cache = cache;
+    if (regions_file && !load_regions(prof, regions_file))
+        return false;
+    strcpy(prof->regions[prof->region_count].name, "other");
+
+    long lines = cache->total_sets * cache->E;
+    if (lines > (1L << 30) ||
+        !cache_init(&prof->shadow, 0, (int)lines, cache->b, "auto", "lru"))
+        return false;
+
+    prof->sets = calloc(cache->total_sets, sizeof(profile_counts_t));
+    prof->seen_cap = SEEN_INITIAL_CAP;
+    prof->seen = calloc(prof->seen_cap, sizeof(unsigned long));
+    if (prof->sets == NULL || prof->seen == NULL) {
+        fprintf(stderr, "Failed to allocate the profile\n");
+        profile_free(prof);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Slot of key in the seen-block set, or the empty slot where it
+ * belongs
+ */
+static long seen_slot(const unsigned long *seen, long cap, unsigned long key) {
+    long mask = cap - 1;
+    long i = (long)((key * HASH_MULTIPLIER) >> 32) & mask;
+    while (seen[i] != 0 && seen[i] != key)
+        i = (i + 1) & mask;
+    return i;
+}
+
+/**
+ * @brief Record block as seen. Return true if it was not seen before.
+ */
+static bool first_touch(profile_t *prof, unsigned long block) {
+    unsigned long key = block + 1;
+    long i = seen_slot(prof->seen, prof->seen_cap, key);
+    if (prof->seen[i] != 0)
+        return false;
+    prof->seen[i] = key;
+    prof->seen_used = prof->seen_used + 1;
+
+    // keep the set at most half full
+    if (2 * prof->seen_used > prof->seen_cap) {
+        long cap = prof->seen_cap * 2;
+        unsigned long *seen = calloc(cap, sizeof(unsigned long));
+        if (seen == NULL) {
+            fprintf(stderr, "Failed to grow the profile\n");
+            abort();
+        }
+        for (long j = 0; j < prof->seen_cap; j++) {
+            if (prof->seen[j] != 0)
+                seen[seen_slot(seen, cap, prof->seen[j])] = prof->seen[j];
+        }
+        free(prof->seen);
+        prof->seen = seen;
+        prof->seen_cap = cap;
+    }
+    return true;
+}
+
+/**
+ * @brief Region holding addr, "other" if none does
+ */
+static profile_region_t *find_region(profile_t *prof, unsigned long addr) {
+    int i;
+    for (i = 0; i < prof->region_count; i++) {
+        if (addr >= prof->regions[i].start && addr < prof->regions[i].end)
+            break;
+    }
+    return &prof->regions[i];
+}
+
+/**
+ * @brief Add one access with this outcome to counts
+ */
+static void count(profile_counts_t *counts, int type, bool cold,
+                  bool shadow_hit) {
+    counts->accesses = counts->accesses + 1;
+    if (type >= 0) {
+        counts->hits = counts->hits + 1;
+        return;
+    }
+    counts->misses = counts->misses + 1;
+    if (type == CACHE_CAPACITY_MISS)
+        counts->evictions = counts->evictions + 1;
+    if (cold)
+        counts->cold = counts->cold + 1;
+    else if (shadow_hit)
+        counts->conflict = counts->conflict + 1;
+    else
+        counts->capacity = counts->capacity + 1;
+}
+
+void profile_access(profile_t *prof, const trace_access_t *access) {
+    cache_t *cache = prof->cache;
+    long set_num, tag;
+    cache_locate(cache, access->addr, &set_num, &tag);
+    int type = cache_access(cache, &cache->stats, set_num, tag,
+                            access->is_load, NULL);
+
+    // the shadow cache sees every access, so its recency stays exact
+    long shadow_set, shadow_tag;
+    cache_locate(&prof->shadow, access->addr, &shadow_set, &shadow_tag);
+    bool shadow_hit = cache_access(&prof->shadow, &prof->shadow.stats,
+                                   shadow_set, shadow_tag, access->is_load,
+                                   NULL) >= 0;
+    bool cold = first_touch(prof, access->addr >> cache->b);
+
+    count(&prof->total, type, cold, shadow_hit);
+    count(&prof->sets[set_num], type, cold, shadow_hit);
+    count(&find_region(prof, access->addr)->counts, type, cold, shadow_hit);
+}
+
+/**
+ * @brief Counters of counts in COLUMNS order
+ */
+static void columns(const profile_counts_t *counts, long values[]) {
+    values[0] = counts->accesses;
+    values[1] = counts->hits;
+    values[2] = counts->misses;
+    values[3] = counts->evictions;
+    values[4] = counts->cold;
+    values[5] = counts->capacity;
+    values[6] = counts->conflict;
+}
+
+static void write_csv_row(FILE *fp, const char *kind, const char *name,
+                          const profile_counts_t *counts) {
+    long values[COLUMN_COUNT];
+    columns(counts, values);
+    fprintf(fp, "%s,%s", kind, name);
+    for (int i = 0; i < COLUMN_COUNT; i++)
+        fprintf(fp, ",%ld", values[i]);
+    fprintf(fp, "\n");
+}
+
+static void write_csv(const profile_t *prof, FILE *fp) {
+    fprintf(fp, "kind,name");
+    for (int i = 0; i < COLUMN_COUNT; i++)
+        fprintf(fp, ",%s", COLUMNS[i]);
+    fprintf(fp, "\n");
+
+    write_csv_row(fp, "total", "all", &prof->total);
+    for (int i = 0; i <= prof->region_count; i++)
+        write_csv_row(fp, "region", prof->regions[i].name,
+                      &prof->regions[i].counts);
+    for (long i = 0; i < prof->cache->total_sets; i++) {
+        char name[24];
+        snprintf(name, sizeof(name), "%ld", i);
+        write_csv_row(fp, "set", name, &prof->sets[i]);
+    }
+}
+
+/**
+ * @brief Write the counters as the members of a JSON object
+ */
+static void write_json_counts(FILE *fp, const profile_counts_t *counts) {
+    long values[COLUMN_COUNT];
+    columns(counts, values);
+    for (int i = 0; i < COLUMN_COUNT; i++)
+        fprintf(fp, "%s\"%s\":%ld", i ? "," : "", COLUMNS[i], values[i]);
+}
+
+static void write_json(const profile_t *prof, FILE *fp) {
+    const cache_t *cache = prof->cache;
+    fprintf(fp, "{\"cache\":{\"s\":%d,\"E\":%d,\"b\":%d},\n\"total\":{",
+            cache->s, cache->E, cache->b);
+    write_json_counts(fp, &prof->total);
+
+    fprintf(fp, "},\n\"regions\":[");
+    for (int i = 0; i <= prof->region_count; i++) {
+        const profile_region_t *region = &prof->regions[i];
+        fprintf(fp, "%s\n{\"name\":\"%s\",", i ? "," : "", region->name);
+        if (i < prof->region_count)
+            fprintf(fp, "\"start\":\"0x%lx\",\"end\":\"0x%lx\",",
+                    region->start, region->end);
+        write_json_counts(fp, &region->counts);
+        fprintf(fp, "}");
+    }
+
+    fprintf(fp, "],\n\"sets\":[");
+    for (long i = 0; i < cache->total_sets; i++) {
+        fprintf(fp, "%s\n{\"set\":%ld,", i ? "," : "", i);
+        write_json_counts(fp, &prof->sets[i]);
+        fprintf(fp, "}");
+    }
+    fprintf(fp, "]}\n");
+}
+
+bool profile_write(const profile_t *prof, const char *file_name) {
+    FILE *fp = fopen(file_name, "w");
+    if (fp == NULL) {
+        fprintf(stderr, "Error creating profile %s\n", file_name);
+        return false;
+    }
+
+    size_t len = strlen(file_name);
+    if (len >= 5 && strcmp(file_name + len - 5, ".json") == 0)
+        write_json(prof, fp);
+    else
+        write_csv(prof, fp);
+
+    if (fclose(fp) != 0) {
+        fprintf(stderr, "Error writing profile %s\n", file_name);
+        return false;
+    }
+    return true;
+}
+
+void profile_free(profile_t *prof) {
+    cache_free(&prof->shadow);
+    free(prof->sets);
+    free(prof->seen);
+    prof->sets = NULL;
+    prof->seen = NULL;
+}
@@ -0,0 +1,93 @@
+/**
+ * @file profile.h
+ * @brief Per-set and per-region miss attribution of one cache
+ *
+ * Every access is charged to its set and to the named address region that
+ * holds its first byte, or to the "other" region. Each miss is also put in
+ * one of the three classes of the 3C model:
+ *
+ *   - cold (compulsory): the first access to the block
+ *   - conflict: a fully associative LRU cache with as many lines, the
+ *     shadow cache, would have hit
+ *   - capacity: the shadow cache misses too
+ *
+ * A regions file has one region per line, '#' starts a comment:
+ *
+ *     <name> <first byte> <end byte>
+ *
+ * with the addresses in hex and the end byte excluded, as tracegen-ct -R
+ * writes for its matrices.
+ */
+
+#ifndef CACHELAB_PROFILE_H
+#define CACHELAB_PROFILE_H
+
+#include <stdbool.h>
+
+#include "cache.h"
+#include "trace.h"
+
+/** @brief Most regions a regions file can name */
+#define PROFILE_MAX_REGIONS 32
+
+/**
+ * @brief Counters of one set or region
+ */
+typedef struct {
+    long accesses;
+    long hits;
+    long misses;
+    long evictions;
+    long cold;
+    long capacity;
+    long conflict;
+} profile_counts_t;
+
+/**
+ * @brief A named address range [start, end)
+ */
+typedef struct {
+    char name[32];
+    unsigned long start;
+    unsigned long end;
+    profile_counts_t counts;
+} profile_region_t;
+
+/**
+ * @brief State of the profile of one cache
+ */
+typedef struct {
+    cache_t *cache;
+    cache_t shadow; /* fully associative, as many lines as cache */
+    profile_counts_t total;
+    profile_counts_t *sets;
+
+    /* the last region is "other", for addresses outside every range */
+    profile_region_t regions[PROFILE_MAX_REGIONS + 1];
+    int region_count;
+
+    /* open-addressing set of every block seen so far, stored as block + 1 */
+    unsigned long *seen;
+    long seen_cap; /* power of two */
+    long seen_used;
+} profile_t;
+
+/**
+ * @brief Profile cache, with the regions of regions_file when it is not
+ * NULL
+ */
+bool profile_init(profile_t *prof, cache_t *cache, const char *regions_file);
+
+/** @brief Run one access through the cache and account for it */
+void profile_access(profile_t *prof, const trace_access_t *access);
+
+/**
+ * @brief Write the report to file_name, as JSON if the name ends in ".json"
+ * and as CSV otherwise
+ */
+bool profile_write(const profile_t *prof, const char *file_name);
+
+/** @brief Release the shadow cache and the counters, but not the cache */
+void profile_free(profile_t *prof);
+
+#endif /* CACHELAB_PROFILE_H */
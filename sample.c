@@ -0,0 +1,205 @@
+/**
+ * @file sample.c
+ * @brief Approximate simulation of a cache from a sample of its accesses
+ */
+
+#include <math.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sample.h"
+
+#define HASH_MULTIPLIER 0x9E3779B97F4A7C15UL
+
+/** @brief Initial number of windows of time sampling */
+#define WINDOW_INITIAL_CAP 64
+
+/** @brief Number of fields of csim_stats_t */
+#define STATS_FIELDS 5
+
+/** @brief Offsets of the fields of csim_stats_t, in printSummary() order */
+static const size_t FIELD_OFFSET[STATS_FIELDS] = {
+    offsetof(csim_stats_t, hits),        offsetof(csim_stats_t, misses),
+    offsetof(csim_stats_t, evictions),   offsetof(csim_stats_t, dirty_bytes),
+    offsetof(csim_stats_t, dirty_evictions),
+};
+
+/** @brief Field f of *stats */
+static long *field(csim_stats_t *stats, int f) {
+    return (long *)((char *)stats + FIELD_OFFSET[f]);
+}
+
+/**
+ * @brief True if set_num is in the sample of set sampling.
+ *
+ * The set numbers are hashed first, so that strided access patterns do not
+ * line up with the sampled sets.
+ */
+static bool set_sampled(const sampler_t *sp, long set_num) {
+    unsigned long mixed = (unsigned long)set_num * HASH_MULTIPLIER;
+    return (mixed >> 32) % (unsigned long)sp->set_ratio == 0;
+}
+
+bool sample_init(sampler_t *sp, cache_t *cache, int set_ratio, long period,
+                 long warmup, long measure) {
+    memset(sp, 0, sizeof(*sp));
+    sp->cache = cache;
+    sp->set_ratio = set_ratio;
+    sp->period = period;
+    sp->warmup = warmup;
+    sp->measure = measure;
+
+    if (set_ratio > 0) {
+        // units are indexed by set number, only sampled ones are touched
+        sp->units = calloc(cache->total_sets, sizeof(csim_stats_t));
+        if (sp->units == NULL) {
+            fprintf(stderr, "Failed to allocate the sample\n");
+            return false;
+        }
+        sp->unit_count = cache->total_sets;
+        for (long i = 0; i < cache->total_sets; i++)
+            sp->sampled_sets = sp->sampled_sets + set_sampled(sp, i);
+        if (sp->sampled_sets == 0) {
+            fprintf(stderr, "No set of the %ld sets is sampled at 1/%d\n",
+                    cache->total_sets, set_ratio);
+            sample_free(sp);
+            return false;
+        }
+    } else {
+        if (period <= 0 || warmup < 0 || measure <= 0 ||
+            warmup + measure > period) {
+            fprintf(stderr, "Time sampling needs 0 < warmup + measure <= "
+                            "period\n");
+            return false;
+        }
+        sp->unit_cap = WINDOW_INITIAL_CAP;
+        sp->units = calloc(sp->unit_cap, sizeof(csim_stats_t));
+        if (sp->units == NULL) {
+            fprintf(stderr, "Failed to allocate the sample\n");
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Statistics of the window of time sampling that starts at period
+ * number window, growing the windows as needed
+ */
+static csim_stats_t *window_stats(sampler_t *sp, long window) {
+    if (window == sp->unit_cap) {
+        long cap = sp->unit_cap * 2;
+        csim_stats_t *units = realloc(sp->units, cap * sizeof(csim_stats_t));
+        if (units == NULL) {
+            fprintf(stderr, "Failed to grow the sample\n");
+            abort();
+        }
+        memset(units + sp->unit_cap, 0,
+               (cap - sp->unit_cap) * sizeof(csim_stats_t));
+        sp->units = units;
+        sp->unit_cap = cap;
+    }
+    if (window == sp->unit_count)
+        sp->unit_count = window + 1;
+    return &sp->units[window];
+}
+
+void sample_access(sampler_t *sp, const trace_access_t *access) {
+    cache_t *cache = sp->cache;
+    long set_num, tag;
+    csim_stats_t *stats;
+    cache_locate(cache, access->addr, &set_num, &tag);
+
+    if (sp->set_ratio > 0) {
+        if (!set_sampled(sp, set_num))
+            return;
+        stats = &sp->units[set_num];
+    } else {
+        long position = sp->accesses % sp->period;
+        long window = sp->accesses / sp->period;
+        sp->accesses = sp->accesses + 1;
+        if (position < sp->warmup)
+            stats = &sp->scratch;
+        else if (position < sp->warmup + sp->measure)
+            stats = window_stats(sp, window);
+        else
+            return;
+    }
+    cache_access(cache, stats, set_num, tag, access->is_load, NULL);
+}
+
+long sample_units(const sampler_t *sp) {
+    return sp->set_ratio > 0 ? sp->sampled_sets : sp->unit_count;
+}
+
+/**
+ * @brief Estimate of a total over population units from the sample units
+ * of field f, and the half width of its confidence interval
+ */
+static void estimate_field(sampler_t *sp, int f, double population,
+                           long *estimate, long *half_width) {
+    double sum = 0, sum_sq = 0;
+    long count = 0;
+    for (long i = 0; i < sp->unit_count; i++) {
+        if (sp->set_ratio > 0 && !set_sampled(sp, i))
+            continue;
+        double y = (double)*field(&sp->units[i], f);
+        sum += y;
+        sum_sq += y * y;
+        count = count + 1;
+    }
+
+    *half_width = SAMPLE_UNKNOWN;
+    if (count == 0) {
+        *estimate = 0;
+        return;
+    }
+    double mean = sum / count;
+    *estimate = lround(population * mean);
+    if (count < 2)
+        return;
+
+    double variance = (sum_sq - sum * mean) / (count - 1);
+    double correction = 1 - count / population;
+    if (variance < 0 || correction < 0)
+        variance = 0;
+    *half_width = lround(SAMPLE_Z * population *
+                         sqrt(correction * variance / count));
+}
+
+void sample_estimate(sampler_t *sp, csim_stats_t *estimate,
+                     csim_stats_t *half_width) {
+    double population = (double)sp->cache->total_sets;
+    if (sp->set_ratio == 0) {
+        // an unfinished last window is not a unit of the sample
+        long last = sp->unit_count - 1;
+        if (last >= 0 &&
+            last * sp->period + sp->warmup + sp->measure > sp->accesses) {
+            for (int f = 0; f < STATS_FIELDS; f++)
+                *field(&sp->scratch, f) += *field(&sp->units[last], f);
+            memset(&sp->units[last], 0, sizeof(csim_stats_t));
+            sp->unit_count = last;
+        }
+        population = (double)sp->accesses / sp->measure;
+    }
+
+    for (int f = 0; f < STATS_FIELDS; f++)
+        estimate_field(sp, f, population, field(estimate, f),
+                       field(half_width, f));
+
+    if (sp->set_ratio == 0) {
+        // the lines left in the cache, whichever window dirtied them
+        long dirty = sp->scratch.dirty_bytes;
+        for (long i = 0; i < sp->unit_count; i++)
+            dirty = dirty + sp->units[i].dirty_bytes;
+        estimate->dirty_bytes = dirty;
+        half_width->dirty_bytes = SAMPLE_UNKNOWN;
+    }
+}
+
+void sample_free(sampler_t *sp) {
+    free(sp->units);
+    sp->units = NULL;
+}
@@ -0,0 +1,83 @@
+/**
+ * @file sample.h
+ * @brief Approximate simulation of a cache from a sample of its accesses
+ *
+ * Two kinds of sampling are supported, one at a time:
+ *
+ *   - set sampling simulates only the sets whose number hashes to 0 modulo
+ *     a ratio k, about 1/k of them, and scales their counts by the number
+ *     of sets over the number of sampled sets
+ *   - time sampling splits the trace into periods of P accesses, simulates
+ *     the first W of each period to warm the cache up without counting
+ *     them, counts the next D and skips the rest, then scales the counts by
+ *     the number of accesses over the number counted
+ *
+ * In both cases the sample is a set of units, sampled sets or measured
+ * windows, and the estimate of each field is the population size times the
+ * mean over the units. Its confidence interval comes from the spread of the
+ * units, with the finite population correction.
+ *
+ * With time sampling, dirty_bytes_in_cache is the state of the simulated
+ * cache at the end of the trace, which has no interval.
+ */
+
+#ifndef CACHELAB_SAMPLE_H
+#define CACHELAB_SAMPLE_H
+
+#include <stdbool.h>
+
+#include "cache.h"
+#include "cachelab.h"
+#include "trace.h"
+
+/** @brief Half width sample_estimate() reports when it has none */
+#define SAMPLE_UNKNOWN -1
+
+/** @brief Confidence level of the intervals, in percent, and its quantile */
+#define SAMPLE_CONFIDENCE 95
+#define SAMPLE_Z 1.96
+
+/**
+ * @brief State of a sampled simulation of one cache
+ */
+typedef struct {
+    cache_t *cache;
+    int set_ratio; /* k of set sampling, 0 if not sampling sets */
+    long period;   /* P of time sampling, 0 if not sampling time */
+    long warmup;   /* W */
+    long measure;  /* D */
+
+    /* one entry per set, or per measured window, of which unit_count */
+    csim_stats_t *units;
+    long unit_count;
+    long unit_cap;
+    long sampled_sets;
+
+    csim_stats_t scratch; /* warmup accesses and the unfinished window */
+    long accesses;        /* every access of the trace so far */
+} sampler_t;
+
+/**
+ * @brief Sample cache by sets, with set_ratio > 0, or by time, with
+ * period > 0 and 0 < measure <= period - warmup
+ */
+bool sample_init(sampler_t *sp, cache_t *cache, int set_ratio, long period,
+                 long warmup, long measure);
+
+/** @brief Simulate or skip one access of the trace */
+void sample_access(sampler_t *sp, const trace_access_t *access);
+
+/**
+ * @brief Estimate the statistics of the whole trace into *estimate and the
+ * half widths of their confidence intervals into *half_width
+ */
+void sample_estimate(sampler_t *sp, csim_stats_t *estimate,
+                     csim_stats_t *half_width);
+
+/** @brief Number of units in the sample, sets or windows */
+long sample_units(const sampler_t *sp);
+
+/** @brief Release the units */
+void sample_free(sampler_t *sp);
+
+#endif /* CACHELAB_SAMPLE_H */
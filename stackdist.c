@@ -0,0 +1,220 @@
+/**
+ * @file stackdist.c
+ * @brief Stack-distance (Mattson) simulation of LRU caches
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "stackdist.h"
+
+/** @brief Initial Fenwick capacity of a set, a power of two */
+#define SET_INITIAL_CAP 16
+
+/** @brief Initial number of slots of the block map, a power of two */
+#define MAP_INITIAL_CAP 1024
+
+#define HASH_MULTIPLIER 0x9E3779B97F4A7C15UL
+
+/**
+ * @brief Add delta at position i of a Fenwick tree
+ */
+static void fenwick_add(stackdist_set_t *set, long i, long delta) {
+    for (; i <= set->cap; i += i & -i)
+        set->tree[i] += delta;
+}
+
+/**
+ * @brief Sum of positions 1..i of a Fenwick tree
+ */
+static long fenwick_sum(const stackdist_set_t *set, long i) {
+    long sum = 0;
+    for (; i > 0; i -= i & -i)
+        sum += set->tree[i];
+    return sum;
+}
+
+/**
+ * @brief Slot of block in the map, or the empty slot where it belongs
+ */
+static long map_slot(const stackdist_t *sd, unsigned long block) {
+    long mask = sd->map_cap - 1;
+    long i = (long)((block * HASH_MULTIPLIER) >> 32) & mask;
+    while (sd->last_time[i] != 0 && sd->keys[i] != block)
+        i = (i + 1) & mask;
+    return i;
+}
+
+/**
+ * @brief Double the size of the block map and rehash every entry
+ */
+static bool map_grow(stackdist_t *sd) {
+    unsigned long *old_keys = sd->keys;
+    long *old_time = sd->last_time;
+    long old_cap = sd->map_cap;
+
+    sd->map_cap = old_cap * 2;
+    sd->keys = calloc(sd->map_cap, sizeof(unsigned long));
+    sd->last_time = calloc(sd->map_cap, sizeof(long));
+    if (sd->keys == NULL || sd->last_time == NULL) {
+        free(sd->keys);
+        free(sd->last_time);
+        sd->keys = old_keys;
+        sd->last_time = old_time;
+        sd->map_cap = old_cap;
+        return false;
+    }
+
+    for (long i = 0; i < old_cap; i++) {
+        if (old_time[i] == 0)
+            continue;
+        long slot = map_slot(sd, old_keys[i]);
+        sd->keys[slot] = old_keys[i];
+        sd->last_time[slot] = old_time[i];
+    }
+    free(old_keys);
+    free(old_time);
+    return true;
+}
+
+/**
+ * @brief Renumber the live times of a set to 1..distinct in their order,
+ * doubling its capacity while they would fill more than half of it.
+ *
+ * Only the latest access of each block holds a 1 in the tree, so a set
+ * needs room for its distinct blocks, not for every access of the trace,
+ * and renumbering costs O(1) per access it makes room for.
+ */
+static bool set_compact(stackdist_t *sd, stackdist_set_t *set) {
+    long live = 0;
+    for (long t = 1; t <= set->now; t++) {
+        long slot = map_slot(sd, set->blocks[t]);
+        if (sd->last_time[slot] != t)
+            continue;
+        live = live + 1;
+        sd->last_time[slot] = live;
+        set->blocks[live] = set->blocks[t];
+    }
+
+    long cap = set->cap;
+    while (2 * live > cap)
+        cap = 2 * cap;
+    if (cap != set->cap) {
+        long *tree = realloc(set->tree, (cap + 1) * sizeof(long));
+        if (tree == NULL)
+            return false;
+        set->tree = tree;
+        unsigned long *blocks =
+            realloc(set->blocks, (cap + 1) * sizeof(unsigned long));
+        if (blocks == NULL)
+            return false;
+        set->blocks = blocks;
+        set->cap = cap;
+    }
+
+    // node i covers positions (i - (i & -i), i], of which 1..live hold a 1
+    for (long i = 1; i <= cap; i++) {
+        long low = i - (i & -i);
+        set->tree[i] = (i < live ? i : live) - low;
+        if (set->tree[i] < 0)
+            set->tree[i] = 0;
+    }
+    set->now = live;
+    return true;
+}
+
+bool stackdist_init(stackdist_t *sd, int s, int b, int max_assoc) {
+    memset(sd, 0, sizeof(*sd));
+    sd->s = s;
+    sd->b = b;
+    sd->max_assoc = max_assoc;
+    sd->total_sets = 1L << s;
+    sd->map_cap = MAP_INITIAL_CAP;
+
+    sd->sets = calloc(sd->total_sets, sizeof(stackdist_set_t));
+    sd->keys = calloc(sd->map_cap, sizeof(unsigned long));
+    sd->last_time = calloc(sd->map_cap, sizeof(long));
+    sd->hist = calloc(max_assoc, sizeof(long));
+    if (sd->sets == NULL || sd->keys == NULL || sd->last_time == NULL ||
+        sd->hist == NULL) {
+        fprintf(stderr, "Failed to allocate stack-distance state\n");
+        stackdist_free(sd);
+        return false;
+    }
+    return true;
+}
+
+void stackdist_access(stackdist_t *sd, const trace_access_t *access) {
+    unsigned long block = (unsigned long)((long)access->addr >> sd->b);
+    stackdist_set_t *set = &sd->sets[block & (sd->total_sets - 1)];
+
+    if (set->tree == NULL) {
+        set->tree = calloc(SET_INITIAL_CAP + 1, sizeof(long));
+        set->blocks = calloc(SET_INITIAL_CAP + 1, sizeof(unsigned long));
+        set->cap = SET_INITIAL_CAP;
+        if (set->tree == NULL || set->blocks == NULL)
+            abort();
+    }
+    if (set->now == set->cap && !set_compact(sd, set))
+        abort();
+    set->now = set->now + 1;
+    set->blocks[set->now] = block;
+    sd->accesses = sd->accesses + 1;
+
+    long slot = map_slot(sd, block);
+    long last = sd->last_time[slot];
+    if (last == 0) {
+        sd->cold = sd->cold + 1;
+        set->distinct = set->distinct + 1;
+    } else {
+        // distinct blocks of this set touched strictly after last
+        long distance = fenwick_sum(set, set->now - 1) - fenwick_sum(set, last);
+        if (distance < sd->max_assoc)
+            sd->hist[distance] = sd->hist[distance] + 1;
+        else
+            sd->far = sd->far + 1;
+        fenwick_add(set, last, -1);
+    }
+    fenwick_add(set, set->now, 1);
+
+    if (last == 0) {
+        sd->keys[slot] = block;
+        sd->map_used = sd->map_used + 1;
+    }
+    sd->last_time[slot] = set->now;
+
+    // keep the map at most half full
+    if (2 * sd->map_used > sd->map_cap && !map_grow(sd))
+        abort();
+}
+
+void stackdist_stats(const stackdist_t *sd, int E, csim_stats_t *stats) {
+    long misses = sd->cold + sd->far;
+    for (int d = E; d < sd->max_assoc; d++)
+        misses += sd->hist[d];
+
+    // a set evicts on every miss after its first E distinct blocks
+    long fills = 0;
+    for (long i = 0; i < sd->total_sets; i++)
+        fills += sd->sets[i].distinct < E ? sd->sets[i].distinct : E;
+
+    stats->hits = sd->accesses - misses;
+    stats->misses = misses;
+    stats->evictions = misses - fills;
+    stats->dirty_bytes = STACKDIST_UNSUPPORTED;
+    stats->dirty_evictions = STACKDIST_UNSUPPORTED;
+}
+
+void stackdist_free(stackdist_t *sd) {
+    if (sd->sets) {
+        for (long i = 0; i < sd->total_sets; i++) {
+            free(sd->sets[i].tree);
+            free(sd->sets[i].blocks);
+        }
+    }
+    free(sd->sets);
+    free(sd->keys);
+    free(sd->last_time);
+    free(sd->hist);
+    memset(sd, 0, sizeof(*sd));
+}
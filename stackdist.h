@@ -0,0 +1,76 @@
+/**
+ * @file stackdist.h
+ * @brief Stack-distance (Mattson) simulation of LRU caches
+ *
+ * For a fixed number of sets and block size, an LRU cache with E ways hits
+ * exactly on the accesses whose stack distance, the number of distinct
+ * blocks of the same set touched since the last access to this block, is
+ * below E. One pass that histograms these distances therefore gives the
+ * hits, misses and evictions of every associativity up to a maximum.
+ *
+ * Distances are counted with one Fenwick tree per set over that set's
+ * access times, holding a 1 at the time of each block's latest access, so
+ * each access costs O(log n). When a set runs out of times its live ones
+ * are renumbered, so memory grows with the distinct blocks, not the trace.
+ *
+ * Dirty-byte statistics depend on the victim order of every single
+ * configuration and are not derived; stackdist_stats() reports them as
+ * STACKDIST_UNSUPPORTED.
+ */
+
+#ifndef CACHELAB_STACKDIST_H
+#define CACHELAB_STACKDIST_H
+
+#include "cachelab.h"
+#include "trace.h"
+
+/** @brief Value of the csim_stats_t fields this mode cannot compute */
+#define STACKDIST_UNSUPPORTED -1
+
+/**
+ * @brief Fenwick tree over the access times of one set
+ */
+typedef struct {
+    long *tree;            /* 1-based, cap + 1 entries */
+    unsigned long *blocks; /* blocks[t] was accessed at time t */
+    long cap;              /* power of two */
+    long now;              /* local time of the latest access to this set */
+    long distinct;         /* number of different blocks seen in this set */
+} stackdist_set_t;
+
+/**
+ * @brief State of a stack-distance pass
+ */
+typedef struct {
+    int s;
+    int b;
+    int max_assoc;
+    long total_sets;
+    stackdist_set_t *sets;
+
+    /* open-addressing map from block number to its latest local time */
+    unsigned long *keys;
+    long *last_time; /* 0 for an empty slot */
+    long map_cap;    /* power of two */
+    long map_used;
+
+    /* hist[d] accesses had stack distance d, for d < max_assoc */
+    long *hist;
+    long far;  /* accesses with distance >= max_assoc */
+    long cold; /* first accesses to a block */
+    long accesses;
+} stackdist_t;
+
+/** @brief Set up a pass for 2^s sets, 2^b byte blocks and E <= max_assoc */
+bool stackdist_init(stackdist_t *sd, int s, int b, int max_assoc);
+
+/** @brief Account for one access */
+void stackdist_access(stackdist_t *sd, const trace_access_t *access);
+
+/** @brief Statistics of the E-way LRU cache, 1 <= E <= max_assoc */
+void stackdist_stats(const stackdist_t *sd, int E, csim_stats_t *stats);
+
+/** @brief Release all memory of the pass */
+void stackdist_free(stackdist_t *sd);
+
+#endif /* CACHELAB_STACKDIST_H */
@@ -0,0 +1,227 @@
+/**
+ * @file synth.c
+ * @brief Seeded generators of synthetic access patterns
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "synth.h"
+
+/** @brief Alignment and gap tracegen-ct puts between A and B */
+#define LAYOUT_SPAN 4096
+#define LAYOUT_GAP 2048
+
+#define HASH_MULTIPLIER 0x9E3779B97F4A7C15UL
+
+static const char *PATTERN_NAMES[] = {"stride", "random", "zipf", "transpose"};
+
+#define PATTERN_COUNT 4
+
+bool synth_parse_pattern(synth_pattern_t *pattern, const char *name) {
+    for (int i = 0; i < PATTERN_COUNT; i++) {
+        if (strcmp(name, PATTERN_NAMES[i]) == 0) {
+            *pattern = (synth_pattern_t)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Next number of the splitmix64 sequence in *state
+ */
+static unsigned long next_random(unsigned long *state) {
+    unsigned long z = (*state += HASH_MULTIPLIER);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9UL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBUL;
+    return z ^ (z >> 31);
+}
+
+/**
+ * @brief Uniform double in [0, 1)
+ */
+static double next_uniform(unsigned long *state) {
+    return (double)(next_random(state) >> 11) * 0x1.0p-53;
+}
+
+/*
+ * Zipf ranks come from rejection inversion (Hoermann and Derflinger, 1996),
+ * which takes constant time per rank and needs no table of the n ranks.
+ * helper1(x) is log1p(x) / x and helper2(x) is expm1(x) / x, both precise
+ * near 0.
+ */
+
+static double helper1(double x) {
+    if (fabs(x) > 1e-8)
+        return log1p(x) / x;
+    return 1 - x * (0.5 - x * (1.0 / 3 - 0.25 * x));
+}
+
+static double helper2(double x) {
+    if (fabs(x) > 1e-8)
+        return expm1(x) / x;
+    return 1 + x * 0.5 * (1 + x * (1.0 / 3) * (1 + 0.25 * x));
+}
+
+static double zipf_h(double x, double theta) { return exp(-theta * log(x)); }
+
+static double zipf_integral(double x, double theta) {
+    double log_x = log(x);
+    return helper2((1 - theta) * log_x) * log_x;
+}
+
+static double zipf_inverse(double x, double theta) {
+    double t = x * (1 - theta);
+    if (t < -1)
+        t = -1;
+    return exp(helper1(t) * x);
+}
+
+/**
+ * @brief Zipf-distributed rank in 1 .. gen->slots
+ */
+static unsigned long next_rank(synth_t *gen) {
+    double theta = gen->config.theta;
+    for (;;) {
+        double u = gen->zipf_n +
+                   next_uniform(&gen->rng) * (gen->zipf_x1 - gen->zipf_n);
+        double x = zipf_inverse(u, theta);
+        double k = floor(x + 0.5);
+        if (k < 1)
+            k = 1;
+        else if (k > (double)gen->slots)
+            k = (double)gen->slots;
+        if (k - x <= gen->zipf_s ||
+            u >= zipf_integral(k + 0.5, theta) - zipf_h(k, theta))
+            return (unsigned long)k;
+    }
+}
+
+bool synth_init(synth_t *gen, const synth_config_t *config) {
+    memset(gen, 0, sizeof(*gen));
+    gen->config = *config;
+    gen->rng = config->seed;
+    if (config->pattern == SYNTH_TRANSPOSE) {
+        gen->config.sizes[0] = sizeof(double);
+        gen->config.size_count = 1;
+        if (config->n < 1) {
+            fprintf(stderr, "A transpose needs a matrix of at least 1x1\n");
+            return false;
+        }
+        return true;
+    }
+
+    if (config->size_count < 1 || config->size_count > SYNTH_MAX_SIZES) {
+        fprintf(stderr, "A pattern needs 1 to %d access sizes\n",
+                SYNTH_MAX_SIZES);
+        return false;
+    }
+    gen->grain = 0;
+    for (int i = 0; i < config->size_count; i++) {
+        if (config->sizes[i] == 0) {
+            fprintf(stderr, "Access sizes must be positive\n");
+            return false;
+        }
+        if (config->sizes[i] > gen->grain)
+            gen->grain = config->sizes[i];
+    }
+    gen->slots = config->span / gen->grain;
+    if (gen->slots == 0) {
+        fprintf(stderr, "The working set is smaller than an access\n");
+        return false;
+    }
+
+    if (config->pattern == SYNTH_ZIPF) {
+        double theta = config->theta;
+        if (!(theta > 0)) {
+            fprintf(stderr, "A Zipf exponent must be positive\n");
+            return false;
+        }
+        gen->zipf_x1 = zipf_integral(1.5, theta) - 1;
+        gen->zipf_n = zipf_integral((double)gen->slots + 0.5, theta);
+        gen->zipf_s =
+            2 - zipf_inverse(zipf_integral(2.5, theta) - zipf_h(2, theta),
+                             theta);
+    }
+    return true;
+}
+
+/**
+ * @brief Size and kind of the next STRIDE, RANDOM or ZIPF access
+ */
+static void next_kind(synth_t *gen, trace_access_t *access) {
+    const synth_config_t *config = &gen->config;
+    int count = config->size_count;
+    access->size = config->sizes[count == 1 ? 0
+                                            : next_random(&gen->rng) % count];
+    access->is_load = config->store_percent <= 0 ||
+                      (int)(next_random(&gen->rng) % 100) >=
+                          config->store_percent;
+    access->continued = false;
+}
+
+/**
+ * @brief Slot the Zipf rank k stands for
+ */
+static unsigned long rank_slot(const synth_t *gen, unsigned long k) {
+    unsigned long slots = gen->slots;
+    if ((slots & (slots - 1)) != 0)
+        return k - 1;
+
+    // an odd multiplier permutes the slots of a power-of-two working set
+    return ((k - 1) * HASH_MULTIPLIER) & (slots - 1);
+}
+
+void synth_fill(synth_t *gen, trace_access_t *accesses, int count) {
+    const synth_config_t *config = &gen->config;
+    switch (config->pattern) {
+    case SYNTH_STRIDE:
+        for (int i = 0; i < count; i++) {
+            accesses[i].addr = config->base + gen->offset;
+            next_kind(gen, &accesses[i]);
+            gen->offset = (gen->offset + config->stride) % config->span;
+        }
+        break;
+    case SYNTH_RANDOM:
+        for (int i = 0; i < count; i++) {
+            unsigned long slot = next_random(&gen->rng) % gen->slots;
+            accesses[i].addr = config->base + slot * gen->grain;
+            next_kind(gen, &accesses[i]);
+        }
+        break;
+    case SYNTH_ZIPF:
+        for (int i = 0; i < count; i++) {
+            unsigned long slot = rank_slot(gen, next_rank(gen));
+            accesses[i].addr = config->base + slot * gen->grain;
+            next_kind(gen, &accesses[i]);
+        }
+        break;
+    case SYNTH_TRANSPOSE: {
+        long n = config->n;
+        unsigned long bytes = (unsigned long)(n * n) * sizeof(double);
+        unsigned long b_base = config->base +
+                               (bytes + LAYOUT_SPAN - 1) / LAYOUT_SPAN *
+                                   LAYOUT_SPAN +
+                               LAYOUT_GAP;
+        for (int i = 0; i < count; i++) {
+            long row = gen->element / n;
+            long col = gen->element % n;
+            accesses[i].size = sizeof(double);
+            accesses[i].continued = false;
+            if (gen->store_next) {
+                accesses[i].addr = b_base + (col * n + row) * sizeof(double);
+                accesses[i].is_load = false;
+                gen->element = (gen->element + 1) % (n * n);
+            } else {
+                accesses[i].addr =
+                    config->base + (row * n + col) * sizeof(double);
+                accesses[i].is_load = true;
+            }
+            gen->store_next = !gen->store_next;
+        }
+        break;
+    }
+    }
+}
@@ -0,0 +1,87 @@
+/**
+ * @file synth.h
+ * @brief Seeded generators of synthetic access patterns
+ *
+ * A generator produces an endless, reproducible stream of accesses; the
+ * caller decides how many to take. The patterns are:
+ *
+ *   - SYNTH_STRIDE: base, base + stride, base + 2 * stride, ... wrapping
+ *     around in a working set of span bytes. A stride of the access size
+ *     is a sequential scan.
+ *   - SYNTH_RANDOM: uniformly random slots of the working set
+ *   - SYNTH_ZIPF: slots of the working set drawn from a Zipf distribution
+ *     of exponent theta, so few slots take most accesses. The popular
+ *     slots are spread over the working set when it holds a power of two
+ *     slots, and are at its start otherwise.
+ *   - SYNTH_TRANSPOSE: the loads and stores of the naive transpose of an
+ *     n x n matrix of doubles, A[i][j] loaded then B[j][i] stored, laid
+ *     out as tracegen-ct lays out its matrices, repeated forever
+ *
+ * A slot is as large as the largest access size. The size of every access
+ * is drawn uniformly from sizes, and STRIDE, RANDOM and ZIPF accesses are
+ * stores with probability store_percent. TRANSPOSE accesses are 8 bytes.
+ */
+
+#ifndef CACHELAB_SYNTH_H
+#define CACHELAB_SYNTH_H
+
+#include "trace.h"
+
+/** @brief Most access sizes a generator picks from */
+#define SYNTH_MAX_SIZES 8
+
+/**
+ * @brief Access patterns, named on command lines as in the comments
+ */
+typedef enum {
+    SYNTH_STRIDE,    /* "stride" */
+    SYNTH_RANDOM,    /* "random" */
+    SYNTH_ZIPF,      /* "zipf" */
+    SYNTH_TRANSPOSE, /* "transpose" */
+} synth_pattern_t;
+
+/**
+ * @brief What a generator produces
+ */
+typedef struct {
+    synth_pattern_t pattern;
+    unsigned long base; /* first byte of the working set or of A */
+    unsigned long span; /* bytes of the working set */
+    unsigned long stride;
+    long n;             /* matrix dimension, TRANSPOSE */
+    double theta;       /* Zipf exponent, ZIPF */
+    unsigned int sizes[SYNTH_MAX_SIZES];
+    int size_count;
+    int store_percent;
+    unsigned long seed;
+} synth_config_t;
+
+/**
+ * @brief State of a generator
+ */
+typedef struct {
+    synth_config_t config;
+    unsigned long rng;
+    unsigned long grain;   /* bytes per slot */
+    unsigned long slots;   /* slots in the working set */
+    unsigned long offset;  /* STRIDE: of the next access from base */
+    long element;          /* TRANSPOSE: next element, in row order */
+    bool store_next;       /* TRANSPOSE: the store of element comes next */
+    double zipf_x1;        /* ZIPF: constants of rejection inversion */
+    double zipf_n;
+    double zipf_s;
+} synth_t;
+
+/** @brief Parse a pattern name, see synth_pattern_t */
+bool synth_parse_pattern(synth_pattern_t *pattern, const char *name);
+
+/**
+ * @brief Start a generator at the beginning of its stream. Return false if
+ * config describes no accesses.
+ */
+bool synth_init(synth_t *gen, const synth_config_t *config);
+
+/** @brief Produce the next count accesses of the stream */
+void synth_fill(synth_t *gen, trace_access_t *accesses, int count);
+
+#endif /* CACHELAB_SYNTH_H */
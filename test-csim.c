@@ -4,13 +4,35 @@
  *
  * This program checks the correctness of a student's test cache simulator
  * (csim) by comparing its output to a reference simulator provided by the
- * instructors (csim-ref).
+ * instructors (csim-ref). The tested results come from the cache engine
+ * csim is built on, linked into this program; -c runs ./csim instead, to
+ * also check its command line parsing.
+ *
+ * The tests are jobs run by a pool of worker threads. Each distinct trace
+ * is decoded once, by the first job that needs it, and every job on a
+ * trace with the same content simulates those decoded accesses. Each
+ * worker owns a queue of jobs and steals from the others once it is
+ * empty. The reference simulator writes .csim_results in its working
+ * directory, so each worker runs it in a scratch directory of its own.
+ *
+ * -m replaces the built-in tests with a manifest of jobs, one per line:
+ *
+ *     <s> <E> <b> <trace> [<weight>]
+ *
+ * Blank lines and lines starting with # are skipped. -C keeps each
+ * decoded trace in a directory, in the binary format and named by the
+ * hash of its content, so later runs decode text traces only once.
  */
 
+#define _POSIX_C_SOURCE 200809L /* for mkdtemp and sysconf */
+
 #include <errno.h>
+#include <fcntl.h>
 #include <getopt.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -18,10 +40,20 @@
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include "cache.h"
 #include "cachelab.h"
 
 #define MAX_STR 1024 /* Max string size */
 
+/** @brief Most worker threads -j can start */
+#define MAX_THREADS 64
+
+/** @brief Accesses simulated per cache_run() call */
+#define SIMULATE_BATCH (1 << 20)
+
+/** @brief Bytes of a trace hashed per read() */
+#define HASH_BUFFER_SIZE (64 * 1024)
+
 /** @brief Number of tests */
 #define N 11
 
@@ -34,6 +66,8 @@ typedef struct {
     int b;
     int weight;
     const char *filename;
+    bool split;            /* check csim -B, reported apart from the grade */
+    const char *reference; /* split: filename split by hand, for csim-ref */
 } trace_info_t;
 
 /** @brief Information about each trace to test */
@@ -55,15 +89,107 @@ static const trace_info_t TRACE_INFO[N] = {
     {.s = 5, .E = 1, .b = 5, .weight = 2, .filename = TRACES_DIR "long.trace"},
 };
 
-static int num_runs = 0; // used to randomize input to students' csim
+/** @brief Number of block splitting checks */
+#define N_SPLIT 2
+
+/**
+ * @brief Block splitting checks: the simulator splits straddling accesses
+ * itself (csim -B), the reference runs on the trace split at b by hand
+ */
+static const trace_info_t SPLIT_INFO[N_SPLIT] = {
+    {.s = 2,
+     .E = 1,
+     .b = 2,
+     .weight = 1,
+     .filename = TRACES_DIR "straddle.trace",
+     .split = true,
+     .reference = TRACES_DIR "straddle-b2.trace"},
+    {.s = 3,
+     .E = 2,
+     .b = 4,
+     .weight = 1,
+     .filename = TRACES_DIR "straddle.trace",
+     .split = true,
+     .reference = TRACES_DIR "straddle-b4.trace"},
+};
+
+/**
+ * @brief ./csim -B -v on the first split check must print this, every
+ * block of an access under the line number of the access
+ */
+#define SPLIT_VERBOSE TRACES_DIR "straddle-b2.verbose"
+
+/** @brief Run ./csim for the tested results instead of the linked engine */
+static bool use_command = false;
+
+/**
+ * @brief One simulation to check and what came out of it
+ */
+typedef struct {
+    trace_info_t info;
+    int trace;     /* index into batch.traces */
+    int reference; /* index into batch.traces of the csim-ref trace */
+    bool success;
+    csim_stats_t ref_stats;
+    csim_stats_t test_stats;
+} job_t;
+
+/**
+ * @brief A distinct trace file and, once a job needed it, its accesses
+ */
+typedef struct {
+    const char *filename;
+    char path[2 * MAX_STR]; /* absolute, for simulators in scratch dirs */
+    bool hashing;           /* a job is hashing its file */
+    bool hashed;            /* hash is known */
+    bool loading;           /* a job is decoding it */
+    bool loaded;            /* decoding is over, ok tells how it went */
+    bool ok;
+    bool shared;   /* accesses belong to a trace of the same content */
+    uint64_t hash; /* of the content of the file */
+    trace_access_t *accesses;
+    long count;
+} trace_entry_t;
+
+/**
+ * @brief The jobs a worker has left, [head, tail) of its slice of order
+ */
+typedef struct {
+    pthread_mutex_t lock;
+    int head;
+    int tail;
+} job_queue_t;
+
+/** @brief The jobs and traces, shared by the worker threads */
+static struct {
+    pthread_mutex_t lock;   /* protects the hash and loading state of traces */
+    pthread_cond_t changed; /* a trace finished loading */
+    job_t *jobs;
+    int job_count;
+    trace_entry_t *traces;
+    int trace_count;
+    job_queue_t queues[MAX_THREADS];
+    int threads;
+    const char *cache_dir; /* -C, NULL to keep decoded traces in memory */
+    char cwd[MAX_STR];
+} batch = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER};
 
 /*
  * usage - Prints usage info
  */
 static void usage(char *argv[]) {
-    printf("Usage: %s [-h]\n", argv[0]);
+    printf("Usage: %s [-hc] [-j <threads>] [-m <manifest>] [-C <dir>]\n",
+           argv[0]);
     printf("Options:\n");
-    printf("  -h    Print this help message.\n");
+    printf("  -h            Print this help message.\n");
+    printf("  -c            Run ./csim instead of calling the cache "
+           "engine.\n");
+    printf("  -j <threads>  Run this many tests at a time (default: one "
+           "per CPU)\n");
+    printf("  -m <manifest> Run the jobs of a manifest, \"<s> <E> <b> "
+           "<trace> [<weight>]\"\n"
+           "                per line, instead of the built-in tests\n");
+    printf("  -C <dir>      Keep decoded traces in dir for later runs\n");
 }
 
 /**
@@ -77,98 +203,383 @@ static void sigalrm_handler(int signum) {
     _exit(1);
 }
 
+/**
+ * @brief Read the statistics a simulator left in dir/.csim_results, as
+ * loadSummary() does for the working directory
+ */
+static bool load_results(const char *dir, csim_stats_t *stats) {
+    char name[MAX_STR];
+    snprintf(name, sizeof(name), "%s/.csim_results", dir);
+    FILE *fp = fopen(name, "r");
+    if (fp == NULL) {
+        fprintf(stderr, "Failed to open .csim_results: %s\n", strerror(errno));
+        return false;
+    }
+
+    bool success = fscanf(fp, "%ld %ld %ld %ld %ld", &stats->hits,
+                          &stats->misses, &stats->evictions,
+                          &stats->dirty_bytes, &stats->dirty_evictions) == 5;
+    if (!success)
+        fprintf(stderr, "Error: Results for csim not formatted correctly\n");
+    fclose(fp);
+    return success;
+}
+
+/**
+ * @brief Run a shell command in the scratch directory dir
+ *
+ * @return false if it could not run or exited with an error
+ */
+static bool run_command(const char *cmd, const char *dir) {
+    int status;
+    pid_t pid = fork();
+    if (pid == 0) {
+        if (chdir(dir) < 0)
+            _exit(127);
+        execl("/bin/sh", "sh", "-c", cmd, (char *)NULL);
+        _exit(127);
+    }
+    if (pid < 0 || waitpid(pid, &status, 0) < 0) {
+        fprintf(stderr, "Error invoking csim: %s\n", strerror(errno));
+        return false;
+    }
+    if (WIFEXITED(status) && WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "Error running csim: Status %d\n", WEXITSTATUS(status));
+        return false;
+    }
+    return true;
+}
+
 /**
  * @brief Runs a cache simulation and collects the resulting statistics.
  *
- * @param[in]  cmd    The command used to invoke csim
+ * @param[in]  cmd    The command used to invoke csim, with absolute paths
+ * @param[in]  dir    The scratch directory of the calling worker
  * @param[out] stats  The statistics collected from this simulation run
  *
  * @return false if any problems, true if OK.
  */
-static bool run_csim(const char *cmd, csim_stats_t *stats) {
-    int status;
-
-    status = unlink(".csim_results");
+static bool run_csim(const char *cmd, const char *dir, csim_stats_t *stats) {
+    char results[MAX_STR];
+    snprintf(results, sizeof(results), "%s/.csim_results", dir);
+    int status = unlink(results);
     if (status < 0 && errno != ENOENT) {
         fprintf(stderr, "Error removing old simulation results: %s\n",
                 strerror(errno));
         return false;
     }
 
-    /* Run the simulator command */
-    status = system(cmd);
-    if (status < 0) {
-        fprintf(stderr, "Error invoking csim: %s\n", strerror(errno));
-        return false;
-    }
-    if (WIFEXITED(status) && WEXITSTATUS(status) != 0) {
-        fprintf(stderr, "Error running csim: Status %d\n", WEXITSTATUS(status));
+    /* Run the simulator command in the scratch directory */
+    if (!run_command(cmd, dir))
         return false;
-    }
 
     /* Get the results from the simulator */
-    bool success = loadSummary(stats);
+    bool success = load_results(dir, stats);
     if (!success) {
         fprintf(stderr, "Error: Results for csim not found. Use the "
                         "printSummary() function\n");
     }
 
-    status = unlink(".csim_results");
+    status = unlink(results);
     (void)status;
 
     return success;
 }
 
+/**
+ * @brief FNV-1a hash of the content of the file at path
+ */
+static bool hash_file(const char *path, uint64_t *hash) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    unsigned char buffer[HASH_BUFFER_SIZE];
+    uint64_t h = 0xcbf29ce484222325UL;
+    ssize_t n;
+    while ((n = read(fd, buffer, sizeof(buffer))) > 0) {
+        for (ssize_t i = 0; i < n; i++)
+            h = (h ^ buffer[i]) * 0x100000001b3UL;
+    }
+    close(fd);
+    if (n < 0) {
+        fprintf(stderr, "Failed to read %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    *hash = h;
+    return true;
+}
+
+/**
+ * @brief Decode every access of the trace at path into entry
+ */
+static bool read_trace(trace_entry_t *entry, const char *path) {
+    trace_reader_t reader;
+    if (!trace_open(&reader, path))
+        return false;
+
+    long capacity = 0;
+    const trace_access_t *run;
+    long count;
+    while ((count = trace_next_run(&reader, &run)) > 0) {
+        if (entry->count + count > capacity) {
+            long grown = capacity ? 2 * capacity : 4096;
+            while (grown < entry->count + count)
+                grown = 2 * grown;
+            trace_access_t *accesses =
+                realloc(entry->accesses, grown * sizeof(trace_access_t));
+            if (accesses == NULL) {
+                fprintf(stderr, "Failed to allocate the accesses of %s\n",
+                        path);
+                trace_close(&reader);
+                return false;
+            }
+            entry->accesses = accesses;
+            capacity = grown;
+        }
+        memcpy(entry->accesses + entry->count, run,
+               count * sizeof(trace_access_t));
+        entry->count = entry->count + count;
+    }
+    return trace_close(&reader);
+}
+
+/**
+ * @brief Write the accesses of entry to cached in the binary format. The
+ * file appears under its name only once it is complete. A failure only
+ * costs later runs the decoding, so it is a warning.
+ */
+static void write_cached(const trace_entry_t *entry, const char *cached) {
+    char temp[MAX_STR];
+    snprintf(temp, sizeof(temp), "%s.%ld.tmp", cached, (long)getpid());
+    trace_writer_t writer;
+    if (!trace_writer_open(&writer, temp, true)) {
+        fprintf(stderr, "Warning: %s is not cached\n", entry->path);
+        return;
+    }
+    for (long done = 0; done < entry->count; done += SIMULATE_BATCH) {
+        long count = entry->count - done;
+        if (count > SIMULATE_BATCH)
+            count = SIMULATE_BATCH;
+        trace_write_batch(&writer, entry->accesses + done, (int)count);
+    }
+    if (!trace_writer_close(&writer)) {
+        fprintf(stderr, "Warning: failed to write %s, %s is not cached\n",
+                temp, entry->path);
+        unlink(temp);
+    } else if (rename(temp, cached) < 0) {
+        fprintf(stderr, "Warning: failed to rename %s to %s: %s\n", temp,
+                cached, strerror(errno));
+        unlink(temp);
+    }
+}
+
+/**
+ * @brief Decode the trace of entry, from the -C directory when it holds
+ * it, and keep it there otherwise
+ */
+static bool decode_trace(trace_entry_t *entry) {
+    if (batch.cache_dir == NULL)
+        return read_trace(entry, entry->path);
+    char cached[MAX_STR];
+    snprintf(cached, sizeof(cached), "%s/%016lx.bin", batch.cache_dir,
+             (unsigned long)entry->hash);
+    if (access(cached, R_OK) == 0)
+        return read_trace(entry, cached);
+    if (!read_trace(entry, entry->path))
+        return false;
+    write_cached(entry, cached);
+    return true;
+}
+
+/**
+ * @brief The trace of the same content as entry that a job is decoding or
+ * has decoded, entry itself included, or NULL if there is none. Needs
+ * batch.lock.
+ */
+static const trace_entry_t *find_content(const trace_entry_t *entry) {
+    for (int i = 0; i < batch.trace_count; i++) {
+        const trace_entry_t *other = &batch.traces[i];
+        if (other->hashed && other->hash == entry->hash &&
+            (other->loading || other->loaded))
+            return other;
+    }
+    return NULL;
+}
+
+/**
+ * @brief The decoded trace of batch.traces[index], decoding it if no job
+ * did before for it or a trace of the same content. Return NULL if it
+ * could not be decoded.
+ */
+static const trace_entry_t *load_trace(int index) {
+    trace_entry_t *entry = &batch.traces[index];
+    pthread_mutex_lock(&batch.lock);
+    // other jobs go on looking up traces while this one reads the file
+    while (entry->hashing)
+        pthread_cond_wait(&batch.changed, &batch.lock);
+    if (!entry->hashed && !entry->loaded) {
+        entry->hashing = true;
+        pthread_mutex_unlock(&batch.lock);
+
+        uint64_t hash = 0;
+        bool ok = hash_file(entry->path, &hash);
+
+        pthread_mutex_lock(&batch.lock);
+        entry->hash = hash;
+        entry->hashed = ok;
+        entry->loaded = !ok;
+        entry->hashing = false;
+        pthread_cond_broadcast(&batch.changed);
+    }
+
+    // the hash is published with the lookup below under one lock, so no
+    // two names of one content both decode
+    while (!entry->loaded) {
+        const trace_entry_t *other = find_content(entry);
+        if (other == NULL) {
+            entry->loading = true;
+            pthread_mutex_unlock(&batch.lock);
+
+            bool ok = decode_trace(entry);
+
+            pthread_mutex_lock(&batch.lock);
+            entry->ok = ok;
+            entry->loaded = true;
+            entry->loading = false;
+            pthread_cond_broadcast(&batch.changed);
+        } else if (other->loading) {
+            pthread_cond_wait(&batch.changed, &batch.lock);
+        } else {
+            entry->accesses = other->accesses;
+            entry->count = other->count;
+            entry->shared = true;
+            entry->ok = other->ok;
+            entry->loaded = true;
+        }
+    }
+    pthread_mutex_unlock(&batch.lock);
+    return entry->ok ? entry : NULL;
+}
+
+/**
+ * @brief Simulate the decoded trace on the cache of info with the linked
+ * engine, as cache_simulate() does for a trace file
+ */
+static bool simulate_trace(const trace_info_t *info,
+                           const trace_entry_t *entry, csim_stats_t *stats) {
+    cache_t cache;
+    if (!cache_init(&cache, info->s, info->E, info->b, "auto", "lru"))
+        return false;
+    for (long done = 0; done < entry->count; done += SIMULATE_BATCH) {
+        long count = entry->count - done;
+        if (count > SIMULATE_BATCH)
+            count = SIMULATE_BATCH;
+        cache_run(&cache, &cache.stats, entry->accesses + done, (int)count);
+    }
+    *stats = cache.stats;
+    cache_free(&cache);
+    return true;
+}
+
+/**
+ * @brief Simulate the trace at path with its accesses split at the block
+ * boundaries of the cache of info, as csim -B does
+ */
+static bool simulate_split(const trace_info_t *info, const char *path,
+                           csim_stats_t *stats) {
+    cache_t cache;
+    trace_reader_t reader;
+    if (!cache_init(&cache, info->s, info->E, info->b, "auto", "lru"))
+        return false;
+    if (!trace_open(&reader, path)) {
+        cache_free(&cache);
+        return false;
+    }
+    trace_split_blocks(&reader, info->b);
+    cache_run_trace(&cache, &reader);
+    bool ok = trace_close(&reader);
+    *stats = cache.stats;
+    cache_free(&cache);
+    return ok;
+}
+
 /*
  * @brief Collects run results for a particular trace
  *
  * Runs the reference and trace simulators on a particular trace and set of
  * cache parameters, and collects the results for the caller.
  *
- * @param[in]  info        Information about the trace to run
- * @param[out] ref_stats   Statistics for the reference simulator
- * @param[out] test_stats  Statistics for the simulator being tested
+ * @param[in]  job         The job to run, whose results it fills in
+ * @param[in]  run         Index of the job, to vary the ./csim arguments
+ * @param[in]  dir         Scratch directory of the calling worker
  *
  * @return false if any problems, true if OK.
  */
-static bool runtrace(const trace_info_t *info, csim_stats_t *ref_stats,
-                     csim_stats_t *test_stats) {
-    char cmd[MAX_STR];
+static bool runtrace(job_t *job, int run, const char *dir) {
+    const trace_info_t *info = &job->info;
+    const char *path = batch.traces[job->trace].path;
+    const char *flags = info->split ? " -B" : "";
+    const char *cwd = batch.cwd;
+    csim_stats_t *ref_stats = &job->ref_stats;
+    csim_stats_t *test_stats = &job->test_stats;
+    char cmd[4 * MAX_STR]; /* room for cwd and path */
 
     /* Run the reference simulator */
-    sprintf(cmd, "./csim-ref -s %d -E %d -b %d -t %s > /dev/null", info->s,
-            info->E, info->b, info->filename);
-    if (!run_csim(cmd, ref_stats)) {
+    snprintf(cmd, sizeof(cmd),
+             "%s/csim-ref -s %d -E %d -b %d -t %s > /dev/null", cwd, info->s,
+             info->E, info->b, batch.traces[job->reference].path);
+    if (!run_csim(cmd, dir, ref_stats)) {
         fprintf(stderr, "Running reference simulator failed: '%s'\n", cmd);
         fprintf(stderr, "\n");
         return false;
     }
 
-    /* Run the test simulator */
+    /* Run the test simulator in this process unless asked for ./csim */
+    if (!use_command) {
+        bool simulated;
+        if (info->split) {
+            simulated = simulate_split(info, path, test_stats);
+        } else {
+            const trace_entry_t *entry = load_trace(job->trace);
+            simulated = entry && simulate_trace(info, entry, test_stats);
+        }
+        if (!simulated) {
+            fprintf(stderr, "Running test simulator failed on %s\n",
+                    info->filename);
+            fprintf(stderr, "\n");
+            return false;
+        }
+        return true;
+    }
+
     /* addition 9/28/2017 F17: randomize input to csim to test
      * that students don't hardcode argument parsing */
-    switch (num_runs % 4) {
+    switch (run % 4) {
     case 0:
-        sprintf(cmd, "./csim -b %d -s %d -t %s -E %d > /dev/null", info->b,
-                info->s, info->filename, info->E);
+        snprintf(cmd, sizeof(cmd),
+                 "%s/csim -b %d -s %d -t %s -E %d%s > /dev/null", cwd, info->b,
+                 info->s, path, info->E, flags);
         break;
     case 1:
-        sprintf(cmd, "./csim -t %s -E %d -s %d -b %d > /dev/null",
-                info->filename, info->E, info->s, info->b);
+        snprintf(cmd, sizeof(cmd),
+                 "%s/csim -t %s -E %d -s %d -b %d%s > /dev/null", cwd, path,
+                 info->E, info->s, info->b, flags);
         break;
     case 2:
-        sprintf(cmd, "./csim -E %d -b %d -t %s -s %d > /dev/null", info->E,
-                info->b, info->filename, info->s);
+        snprintf(cmd, sizeof(cmd),
+                 "%s/csim -E %d -b %d -t %s -s %d%s > /dev/null", cwd, info->E,
+                 info->b, path, info->s, flags);
         break;
     case 3:
-        sprintf(cmd, "./csim -s %d -E %d -b %d -t %s > /dev/null", info->s,
-                info->E, info->b, info->filename);
+        snprintf(cmd, sizeof(cmd),
+                 "%s/csim -s %d -E %d -b %d -t %s%s > /dev/null", cwd, info->s,
+                 info->E, info->b, path, flags);
         break;
     }
 
-    num_runs = num_runs + 1;
-
-    if (!run_csim(cmd, test_stats)) {
+    if (!run_csim(cmd, dir, test_stats)) {
         fprintf(stderr, "Running test simulator failed: '%s'\n", cmd);
         fprintf(stderr, "\n");
         return false;
@@ -208,34 +619,253 @@ static void print_trace_results(int points, const trace_info_t *info,
     printf("  %s\n", info->filename);
 }
 
+/**
+ * @brief Take the next job of worker self, or steal the last one of
+ * another worker once its own are done. Return -1 when none are left.
+ */
+static int next_job(int self) {
+    job_queue_t *own = &batch.queues[self];
+    pthread_mutex_lock(&own->lock);
+    int job = own->head < own->tail ? own->head++ : -1;
+    pthread_mutex_unlock(&own->lock);
+
+    // steal from the back, away from jobs the owner will soon reach
+    for (int i = 1; job < 0 && i < batch.threads; i++) {
+        job_queue_t *victim = &batch.queues[(self + i) % batch.threads];
+        pthread_mutex_lock(&victim->lock);
+        if (victim->head < victim->tail) {
+            victim->tail = victim->tail - 1;
+            job = victim->tail;
+        }
+        pthread_mutex_unlock(&victim->lock);
+    }
+    return job;
+}
+
+/**
+ * @brief Body of a worker thread: run jobs until none are left. arg is the
+ * index of the worker.
+ */
+static void *batch_worker(void *arg) {
+    int self = (int)(intptr_t)arg;
+    char dir[] = "/tmp/test-csim.XXXXXX";
+    bool scratch = mkdtemp(dir) != NULL;
+    if (!scratch)
+        fprintf(stderr, "Failed to create a scratch directory: %s\n",
+                strerror(errno));
+
+    int next;
+    while ((next = next_job(self)) >= 0) {
+        job_t *job = &batch.jobs[next];
+        job->success = scratch && runtrace(job, next, dir);
+    }
+    if (scratch)
+        rmdir(dir);
+    return NULL;
+}
+
+/**
+ * @brief Index of filename in the traces, appending it unless it is there
+ */
+static int find_trace(const char *filename) {
+    static int trace_capacity = 0;
+
+    int trace = 0;
+    while (trace < batch.trace_count &&
+           strcmp(batch.traces[trace].filename, filename) != 0)
+        trace = trace + 1;
+    if (trace < batch.trace_count)
+        return trace;
+
+    if (batch.trace_count == trace_capacity) {
+        trace_capacity = trace_capacity ? 2 * trace_capacity : 16;
+        batch.traces =
+            realloc(batch.traces, trace_capacity * sizeof(trace_entry_t));
+        if (batch.traces == NULL) {
+            fprintf(stderr, "Failed to allocate the traces\n");
+            exit(1);
+        }
+    }
+    trace_entry_t *entry = &batch.traces[batch.trace_count];
+    memset(entry, 0, sizeof(*entry));
+    entry->filename = filename;
+    if (filename[0] == '/')
+        snprintf(entry->path, sizeof(entry->path), "%s", filename);
+    else
+        snprintf(entry->path, sizeof(entry->path), "%s/%s", batch.cwd,
+                 filename);
+    batch.trace_count = batch.trace_count + 1;
+    return trace;
+}
+
+/**
+ * @brief Append a job, and its traces to the traces unless they are there
+ */
+static void add_job(const trace_info_t *info) {
+    static int job_capacity = 0;
+
+    if (batch.job_count == job_capacity) {
+        job_capacity = job_capacity ? 2 * job_capacity : 16;
+        batch.jobs = realloc(batch.jobs, job_capacity * sizeof(job_t));
+        if (batch.jobs == NULL) {
+            fprintf(stderr, "Failed to allocate the jobs\n");
+            exit(1);
+        }
+    }
+    job_t *job = &batch.jobs[batch.job_count];
+    memset(job, 0, sizeof(*job));
+    job->info = *info;
+    job->trace = find_trace(info->filename);
+    job->reference = info->split ? find_trace(info->reference) : job->trace;
+    batch.job_count = batch.job_count + 1;
+}
+
+/**
+ * @brief Check that ./csim -B -v prints SPLIT_VERBOSE for the first split
+ * check
+ */
+static bool check_split_verbose(void) {
+    char dir[] = "/tmp/test-csim.XXXXXX";
+    if (mkdtemp(dir) == NULL) {
+        fprintf(stderr, "Failed to create a scratch directory: %s\n",
+                strerror(errno));
+        return false;
+    }
+    const trace_info_t *info = &SPLIT_INFO[0];
+    char cmd[4 * MAX_STR]; /* room for cwd and the trace */
+    snprintf(cmd, sizeof(cmd),
+             "%s/csim -s %d -E %d -b %d -B -v -t %s/%s > output", batch.cwd,
+             info->s, info->E, info->b, batch.cwd, info->filename);
+    char output[MAX_STR], results[MAX_STR];
+    snprintf(output, sizeof(output), "%s/output", dir);
+    snprintf(results, sizeof(results), "%s/.csim_results", dir);
+
+    bool same = false;
+    FILE *expected = fopen(SPLIT_VERBOSE, "r");
+    if (expected == NULL) {
+        fprintf(stderr, "Failed to open %s: %s\n", SPLIT_VERBOSE,
+                strerror(errno));
+    } else if (run_command(cmd, dir)) {
+        FILE *actual = fopen(output, "r");
+        if (actual) {
+            int a, e;
+            do {
+                a = getc(actual);
+                e = getc(expected);
+            } while (a == e && a != EOF);
+            same = a == e;
+            fclose(actual);
+        }
+        if (!same)
+            fprintf(stderr, "'%s' does not print %s\n", cmd, SPLIT_VERBOSE);
+    }
+    if (expected)
+        fclose(expected);
+    unlink(output);
+    unlink(results);
+    rmdir(dir);
+    return same;
+}
+
+/**
+ * @brief Add the jobs of a manifest, see the top of this file
+ */
+static void read_manifest(const char *file_name) {
+    FILE *fp = fopen(file_name, "r");
+    if (fp == NULL) {
+        fprintf(stderr, "Failed to open %s: %s\n", file_name, strerror(errno));
+        exit(1);
+    }
+    char line[MAX_STR], trace[MAX_STR];
+    for (int line_num = 1; fgets(line, sizeof(line), fp); line_num++) {
+        char *start = line + strspn(line, " \t");
+        if (*start == '#' || *start == '\n' || *start == '\0')
+            continue;
+
+        trace_info_t info = {.weight = 1};
+        int fields = sscanf(start, "%d %d %d %1023s %d", &info.s, &info.E,
+                            &info.b, trace, &info.weight);
+        if (fields < 4 || info.s < 0 || info.E < 1 || info.b < 0 ||
+            info.weight < 0) {
+            fprintf(stderr, "%s:%d: expected <s> <E> <b> <trace> [<weight>]\n",
+                    file_name, line_num);
+            exit(1);
+        }
+        info.filename = strdup(trace);
+        add_job(&info);
+    }
+    fclose(fp);
+}
+
+/**
+ * @brief Run every job on up to threads worker threads, each starting on
+ * its own slice of the jobs
+ */
+static void run_jobs(int threads) {
+    if (threads > batch.job_count)
+        threads = batch.job_count;
+    if (threads < 1)
+        threads = 1;
+    batch.threads = threads;
+    for (int w = 0; w < threads; w++) {
+        pthread_mutex_init(&batch.queues[w].lock, NULL);
+        batch.queues[w].head = (int)((long)batch.job_count * w / threads);
+        batch.queues[w].tail = (int)((long)batch.job_count * (w + 1) / threads);
+    }
+
+    /* This thread is one of the workers */
+    pthread_t workers[MAX_THREADS];
+    int started = 1;
+    for (int w = 1; w < threads; w++) {
+        if (pthread_create(&workers[w], NULL, batch_worker,
+                           (void *)(intptr_t)w) != 0)
+            break;
+        started = started + 1;
+    }
+    batch_worker((void *)(intptr_t)0);
+
+    // the first worker steals the jobs of workers that did not start
+    for (int w = 1; w < started; w++)
+        pthread_join(workers[w], NULL);
+}
+
 /**
  * @brief Checks the student's test simulator for correctness by
  *        comparing its results to the reference simulator.
  */
-static void test_csim(void) {
-    /* Output results */
-    csim_stats_t ref_stats[N];
-    csim_stats_t test_stats[N];
-    int points[N];
+static void test_csim(int threads) {
     int total_points = 0;
+    int *points = calloc(batch.job_count, sizeof(int));
+    if (points == NULL) {
+        fprintf(stderr, "Failed to allocate the results\n");
+        exit(1);
+    }
 
-    /* Initialize arrays */
-    for (int i = 0; i < N; i++) {
-        points[i] = 0;
-        ref_stats[i].hits = ref_stats[i].misses = ref_stats[i].evictions =
-            ref_stats[i].dirty_bytes = ref_stats[i].dirty_evictions = -1;
-        test_stats[i].hits = test_stats[i].misses = test_stats[i].evictions =
-            test_stats[i].dirty_bytes = test_stats[i].dirty_evictions = -1;
+    /* Initialize results */
+    for (int i = 0; i < batch.job_count; i++) {
+        csim_stats_t *ref_stats = &batch.jobs[i].ref_stats;
+        csim_stats_t *test_stats = &batch.jobs[i].test_stats;
+        ref_stats->hits = ref_stats->misses = ref_stats->evictions =
+            ref_stats->dirty_bytes = ref_stats->dirty_evictions = -1;
+        test_stats->hits = test_stats->misses = test_stats->evictions =
+            test_stats->dirty_bytes = test_stats->dirty_evictions = -1;
     }
 
     /* Run the individual tests */
-    for (int i = 0; i < N; i++) {
-        bool success = runtrace(&TRACE_INFO[i], &ref_stats[i], &test_stats[i]);
-        if (success) {
-            points[i] = count_matches(&ref_stats[i], &test_stats[i]) *
-                        TRACE_INFO[i].weight;
+    run_jobs(threads);
+    int split_points = 0, split_max = 0;
+    for (int i = 0; i < batch.job_count; i++) {
+        const job_t *job = &batch.jobs[i];
+        if (job->success) {
+            points[i] = count_matches(&job->ref_stats, &job->test_stats) *
+                        job->info.weight;
+        }
+        if (job->info.split) {
+            split_points += points[i];
+            split_max += 5 * job->info.weight;
+        } else {
+            total_points += points[i];
         }
-        total_points += points[i];
     }
 
     /* Display a summary of results */
@@ -244,15 +874,37 @@ static void test_csim(void) {
            "Hits", "Misses", "Evicts", "D_Cache", "D_Evict", "Hits", "Misses",
            "Evicts", "D_Cache", "D_Evict");
 
-    for (int i = 0; i < N; i++) {
-        print_trace_results(points[i], &TRACE_INFO[i], &test_stats[i],
-                            &ref_stats[i]);
+    for (int i = 0; i < batch.job_count; i++) {
+        const job_t *job = &batch.jobs[i];
+        if (!job->info.split)
+            print_trace_results(points[i], &job->info, &job->test_stats,
+                                &job->ref_stats);
     }
 
     printf("%6d\n", total_points);
 
+    /* The block splitting checks are not part of the grade */
+    if (split_max > 0) {
+        printf("\nBlock splitting (csim -B), not graded\n");
+        for (int i = 0; i < batch.job_count; i++) {
+            const job_t *job = &batch.jobs[i];
+            if (job->info.split)
+                print_trace_results(points[i], &job->info, &job->test_stats,
+                                    &job->ref_stats);
+        }
+        int verbose_points = check_split_verbose() ? 5 : 0;
+        printf("%6d %8s  ./csim -B -v prints %s\n", verbose_points, "",
+               SPLIT_VERBOSE);
+        split_points += verbose_points;
+        split_max += 5;
+        printf("%6d\n", split_points);
+    }
+
     /* Print a compact summary string for the driver */
     printf("\nTEST_CSIM_RESULTS=%d\n", total_points);
+    if (split_max > 0)
+        printf("TEST_CSIM_SPLIT_RESULTS=%d/%d\n", split_points, split_max);
+    free(points);
 }
 
 /**
@@ -260,10 +912,28 @@ static void test_csim(void) {
  */
 int main(int argc, char *argv[]) {
     char c;
+    const char *manifest = NULL;
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
 
     /* Parse command line args */
-    while ((c = getopt(argc, argv, "h")) != -1) {
+    while ((c = getopt(argc, argv, "hcj:m:C:")) != -1) {
         switch (c) {
+        case 'c':
+            use_command = true;
+            break;
+        case 'j':
+            threads = atol(optarg);
+            if (threads < 1 || threads > MAX_THREADS) {
+                printf("Error: -j must be between 1 and %d\n", MAX_THREADS);
+                exit(1);
+            }
+            break;
+        case 'm':
+            manifest = optarg;
+            break;
+        case 'C':
+            batch.cache_dir = optarg;
+            break;
         case 'h':
             usage(argv);
             exit(0);
@@ -272,6 +942,24 @@ int main(int argc, char *argv[]) {
             exit(1);
         }
     }
+    if (threads < 1)
+        threads = 1;
+    if (threads > MAX_THREADS)
+        threads = MAX_THREADS;
+
+    if (getcwd(batch.cwd, sizeof(batch.cwd)) == NULL) {
+        fprintf(stderr, "Failed to get the working directory: %s\n",
+                strerror(errno));
+        exit(1);
+    }
+    if (manifest) {
+        read_manifest(manifest);
+    } else {
+        for (int i = 0; i < N; i++)
+            add_job(&TRACE_INFO[i]);
+        for (int i = 0; i < N_SPLIT; i++)
+            add_job(&SPLIT_INFO[i]);
+    }
 
     /* Install timeout handler */
     if (signal(SIGALRM, sigalrm_handler) == SIG_ERR) {
@@ -279,11 +967,13 @@ int main(int argc, char *argv[]) {
         exit(1);
     }
 
-    /* Time out and give up after a while */
-    alarm(20);
+    /* Time out and give up after a while, unless running a manifest of
+     * any size */
+    if (manifest == NULL)
+        alarm(20);
 
     /* Evaluate the student's cache simulator for correctness */
-    test_csim();
+    test_csim((int)threads);
 
     exit(0);
 }
@@ -7,11 +7,16 @@
  * official submitted version as well.
  */
 
+#define _POSIX_C_SOURCE 200809L /* for setenv and sysconf */
+
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <getopt.h>
 #include <limits.h> // for LONG_MAX
+#include <pthread.h>
 #include <signal.h>
+#include <stdarg.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -20,10 +25,16 @@
 #include <sys/wait.h> // for WEXITSTATUS
 #include <unistd.h>
 
+#include "cache.h"
 #include "cachelab.h"
+#include "timing.h"
+
+#define ARG_BUFSIZE 32
+#define ERROR_BUFSIZE 512
 
-#define CMD_BUFSIZE 334
-#define FILENAME_BUFSIZE 255
+/** @brief Descriptor tracegen-ct writes its trace to */
+#define TRACE_FD 3
+#define TRACE_PATH "/dev/fd/3"
 
 /* Globals set on the command line */
 static size_t M = 0;
@@ -34,7 +45,9 @@ static struct {
     int funcid;
     bool correct;
     csim_stats_t stats;
-} results = {-1, false, {LONG_MAX, LONG_MAX, LONG_MAX, LONG_MAX, LONG_MAX}};
+    long cycles;
+} results = {-1, false, {LONG_MAX, LONG_MAX, LONG_MAX, LONG_MAX, LONG_MAX},
+             LONG_MAX};
 
 /**
  * @brief Calculates the number of clock cycles for the trace
@@ -45,97 +58,219 @@ static long get_clock_cycles(long hits, long misses) {
 }
 
 /**
- * @brief Generates a trace file for a specific transpose function.
+ * @brief One transpose function to evaluate and what came out of it
+ */
+typedef struct {
+    int funcid;
+    bool correct;
+    csim_stats_t stats;
+    long cycles;               /* score of the trace */
+    char error[ERROR_BUFSIZE]; /* why it is not correct */
+} job_t;
+
+/** @brief The functions to evaluate, shared by the worker threads */
+static struct {
+    pthread_mutex_t lock; /* protects next and every fork() */
+    job_t *jobs;
+    int count;
+    int next;
+    unsigned int s, E, b;
+    bool timed; /* score with the timing model instead of get_clock_cycles */
+} pool = {PTHREAD_MUTEX_INITIALIZER};
+
+/**
+ * @brief Append a message to the error of a job
+ */
+static void job_error(job_t *job, const char *fmt, ...) {
+    size_t used = strlen(job->error);
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(job->error + used, sizeof(job->error) - used, fmt, ap);
+    va_end(ap);
+}
+
+/**
+ * @brief Starts tracegen-ct for a specific transpose function with its
+ * trace going into a new pipe instead of a file.
  *
- * @param[in] file_name File name where the trace should be stored
- * @param[in] i         Index of the transpose function to use
+ * Other threads fork too, so the pipe is created close-on-exec under the
+ * pool lock; otherwise another tracegen-ct could inherit its write end and
+ * the read end would never see the end of the trace.
  *
- * @return True if the function succeeded, and false otherwise
+ * @param[in]  job     The job of the transpose function to use
+ * @param[out] pid     Process id of tracegen-ct
+ *
+ * @return The read end of the pipe, or -1 if tracegen-ct could not start
  */
-static bool generate_trace(const char *file_name, int i) {
-    char cmd[CMD_BUFSIZE];
-    snprintf(cmd, sizeof(cmd),
-             "CONTECH_TRACE=%s ./tracegen-ct -M %ld -N %ld -F %d", file_name, M,
-             N, i);
-
-    int status = system(cmd);
-    if (status < 0) {
-        printf("Failed to run tracegen-ct: %s\n", strerror(errno));
-        return false;
+static int start_tracegen(job_t *job, pid_t *pid) {
+    char m_arg[ARG_BUFSIZE], n_arg[ARG_BUFSIZE], f_arg[ARG_BUFSIZE];
+    snprintf(m_arg, sizeof(m_arg), "%zu", M);
+    snprintf(n_arg, sizeof(n_arg), "%zu", N);
+    snprintf(f_arg, sizeof(f_arg), "%d", job->funcid);
+
+    int fds[2];
+    pthread_mutex_lock(&pool.lock);
+    if (pipe(fds) < 0) {
+        pthread_mutex_unlock(&pool.lock);
+        job_error(job, "Failed to create a pipe: %s\n", strerror(errno));
+        return -1;
+    }
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+
+    *pid = fork();
+    if (*pid == 0) {
+        /* The tracing runtime writes to the file named by CONTECH_TRACE */
+        if (fds[1] == TRACE_FD)
+            fcntl(TRACE_FD, F_SETFD, 0);
+        else
+            dup2(fds[1], TRACE_FD);
+        execl("./tracegen-ct", "./tracegen-ct", "-M", m_arg, "-N", n_arg,
+              "-F", f_arg, (char *)NULL);
+        _exit(127);
     }
+    pthread_mutex_unlock(&pool.lock);
 
-    if (!WIFEXITED(status)) {
-        printf("Internal error: ./tracegen-ct aborted for unknown "
-               "reason (status %x).\n",
-               status);
-        printf("Command run: %s\n", cmd);
-        return false;
+    close(fds[1]);
+    if (*pid < 0) {
+        job_error(job, "Failed to run tracegen-ct: %s\n", strerror(errno));
+        close(fds[0]);
+        return -1;
     }
+    return fds[0];
+}
 
-    if (WEXITSTATUS(status) != 0) {
-        printf("Validation error at function %d! Run ./tracegen-ct -v -M "
-               "%zd -N %zd -F %d for details.\n",
-               i, M, N, i);
-        printf("Exit status %d\n", WEXITSTATUS(status));
+/**
+ * @brief Simulates the trace of reader access by access, feeding the timing
+ * model, and scores it with the model
+ */
+static bool simulate_timed(cache_t *cache, trace_reader_t *reader,
+                           long *cycles) {
+    timing_t timing;
+    if (!timing_init(&timing, TIMING_WINDOW, TIMING_MSHRS))
         return false;
-    }
 
+    trace_access_t access;
+    while (trace_next(reader, &access)) {
+        long set_num, tag;
+        cache_locate(cache, access.addr, &set_num, &tag);
+        int type = cache_access(cache, &cache->stats, set_num, tag,
+                                access.is_load, NULL);
+        timing_access(&timing, access.addr >> cache->b, type >= 0);
+    }
+    *cycles = timing_cycles(&timing);
+    timing_free(&timing);
     return true;
 }
 
 /**
- * @brief Compute statistics for a trace using the reference simulator.
+ * @brief Validates a specific transpose function and simulates its memory
+ * trace as tracegen-ct produces it, without writing the trace to a file.
  *
- * @param[in]  file_name File name where the trace is be stored
- * @param[in]  s         log2 of the number of sets
- * @param[in]  E         associativity
- * @param[in]  b         log2 of the block size
- * @param[out] stats     Statistics computed from the trace file
+ * @param[in,out] job    The transpose function, gets its statistics
  *
  * @return True if the function succeeded, and false otherwise
  */
-static bool compute_stats(const char *file_name, unsigned int s, unsigned int E,
-                          unsigned int b, csim_stats_t *stats) {
-    char cmd[CMD_BUFSIZE];
-    snprintf(cmd, sizeof(cmd), "./csim-ref -s %u -E %u -b %u -t %s > /dev/null",
-             s, E, b, file_name);
-
-    int status = system(cmd);
-    if (status < 0) {
-        printf("Failed to run csim-ref: %s\n", strerror(errno));
+static bool trace_and_simulate(job_t *job) {
+    int i = job->funcid;
+    cache_t cache;
+    if (!cache_init(&cache, (int)pool.s, (int)pool.E, (int)pool.b, "auto",
+                    "lru")) {
+        job_error(job, "Cache simulator error.  Invalid cache parameters\n");
+        return false;
+    }
+
+    pid_t pid;
+    int fd = start_tracegen(job, &pid);
+    if (fd < 0) {
+        cache_free(&cache);
+        return false;
+    }
+
+    /* Simulate the accesses while tracegen-ct is still producing them */
+    trace_reader_t reader;
+    bool streamed = trace_open_fd(&reader, fd);
+    if (streamed) {
+        if (pool.timed)
+            streamed = simulate_timed(&cache, &reader, &job->cycles);
+        else
+            cache_run_trace(&cache, &reader);
+        trace_close(&reader);
+    } else {
+        close(fd);
+    }
+    job->stats = cache.stats;
+    if (!pool.timed)
+        job->cycles = get_clock_cycles(cache.stats.hits, cache.stats.misses);
+    cache_free(&cache);
+
+    int status;
+    if (waitpid(pid, &status, 0) < 0) {
+        job_error(job, "Failed to wait for tracegen-ct: %s\n",
+                  strerror(errno));
+        return false;
+    }
+
+    if (!WIFEXITED(status)) {
+        job_error(job,
+                  "Internal error: ./tracegen-ct aborted for unknown "
+                  "reason (status %x).\n",
+                  status);
         return false;
     }
 
-    int flag = WEXITSTATUS(status);
-    if (flag != 0) {
-        printf("Cache simulator error.  The reference simulator exited "
-               "with value %d\n",
-               flag);
+    if (WEXITSTATUS(status) == 127) {
+        job_error(job, "Failed to run ./tracegen-ct\n");
         return false;
     }
 
-    /* Collect results from the reference simulator */
-    bool success = loadSummary(stats);
-    if (!success) {
-        printf("Cache simulator error.  Simulator generated invalid "
-               "results\n");
+    if (WEXITSTATUS(status) != 0) {
+        job_error(job,
+                  "Validation error at function %d! Run ./tracegen-ct -v -M "
+                  "%zd -N %zd -F %d for details.\n",
+                  i, M, N, i);
+        job_error(job, "Exit status %d\n", WEXITSTATUS(status));
         return false;
     }
 
+    if (!streamed) {
+        job_error(job, "Cache simulator error.  Could not read the trace\n");
+        return false;
+    }
     return true;
 }
 
 /**
- * @brief Evaluate the performance of the registered transpose functions
+ * @brief Body of a worker thread: evaluate jobs until none are left
+ */
+static void *eval_worker(void *arg) {
+    (void)arg;
+    for (;;) {
+        pthread_mutex_lock(&pool.lock);
+        int next = pool.next;
+        pool.next = pool.next + 1;
+        pthread_mutex_unlock(&pool.lock);
+        if (next >= pool.count)
+            return NULL;
+
+        job_t *job = &pool.jobs[next];
+        job->correct = trace_and_simulate(job);
+    }
+}
+
+/**
+ * @brief Evaluate the performance of the registered transpose functions,
+ * up to threads of them at a time
  */
 static void eval_perf(unsigned int s, unsigned int E, unsigned int b,
-                      bool submission_only) {
+                      bool submission_only, bool timed, int threads) {
 
     registerFunctions();
 
-    /* Evaluate the performance of each registered transpose function */
+    /* Collect the functions to test, remembering which one is submitted */
+    static job_t jobs[MAX_TRANS_FUNCS];
+    int count = 0;
     for (int i = 0; i < func_counter; i++) {
-        /* Remember if this function is the submission */
         if (strcmp(func_list[i].description, SUBMIT_DESCRIPTION) == 0) {
             results.funcid = i;
         }
@@ -145,37 +280,58 @@ static void eval_perf(unsigned int s, unsigned int E, unsigned int b,
             continue;
         }
 
-        /* Run and generate a trace file */
-        char file_name[FILENAME_BUFSIZE];
-        sprintf(file_name, "trace.f%d", i);
+        memset(&jobs[count], 0, sizeof(jobs[count]));
+        jobs[count].funcid = i;
+        count = count + 1;
+    }
 
+    pool.jobs = jobs;
+    pool.count = count;
+    pool.s = s;
+    pool.E = E;
+    pool.b = b;
+    pool.timed = timed;
+    if (threads > count)
+        threads = count;
+
+    /* This thread is one of the workers */
+    pthread_t workers[MAX_TRANS_FUNCS];
+    for (int w = 1; w < threads; w++) {
+        if (pthread_create(&workers[w], NULL, eval_worker, NULL) != 0) {
+            threads = w;
+            break;
+        }
+    }
+    eval_worker(NULL);
+    for (int w = 1; w < threads; w++)
+        pthread_join(workers[w], NULL);
+
+    /* Report every function in order */
+    for (int j = 0; j < count; j++) {
+        const job_t *job = &jobs[j];
+        int i = job->funcid;
         printf("\nFunction %d out of %d (%s)\n", i, func_counter,
                func_list[i].description);
-        printf("Step 1: Validating and generating memory traces\n");
+        printf("Step 1: Validating and simulating memory traces (s=%d, E=%d, "
+               "b=%d)\n",
+               s, E, b);
 
-        if (!generate_trace(file_name, i)) {
+        if (!job->correct) {
+            printf("%s", job->error);
             continue;
         }
 
-        /* Run the reference simulator */
-        csim_stats_t stats;
-
-        printf("Step 2: Evaluating performance (s=%d, E=%d, b=%d)\n", s, E, b);
-        if (!compute_stats(file_name, s, E, b, &stats)) {
-            continue;
-        }
-
-        (void)remove(".csim_results");
-
         /* Mark this function as correct */
+        const csim_stats_t *stats = &job->stats;
         printf("Results for func %d (%s): hits:%ld, misses:%ld, evictions:%ld, "
                "clock_cycles:%ld\n",
-               i, func_list[i].description, stats.hits, stats.misses,
-               stats.evictions, get_clock_cycles(stats.hits, stats.misses));
+               i, func_list[i].description, stats->hits, stats->misses,
+               stats->evictions, job->cycles);
 
         /* If it is transpose_submit(), record number of misses */
         if (results.funcid == i) {
-            memcpy(&results.stats, &stats, sizeof(results.stats));
+            memcpy(&results.stats, stats, sizeof(results.stats));
+            results.cycles = job->cycles;
             results.correct = true;
         }
     }
@@ -185,11 +341,17 @@ static void eval_perf(unsigned int s, unsigned int E, unsigned int b,
  * @brief Print usage info
  */
 static void usage(char *argv[]) {
-    printf("Usage: %s [-h] [-s] -M <rows> -N <cols>\n", argv[0]);
+    printf("Usage: %s [-h] [-s] [-t] [-j <jobs>] -M <rows> -N <cols>\n",
+           argv[0]);
     printf("Options:\n");
     printf("  -h          Print this help message.\n");
     printf("  -s          Check official submission only.\n");
     printf("  -l          Simulate large (Haswell L1) cache\n");
+    printf("  -t          Score cycles with overlapping misses (%d accesses "
+           "in flight, %d MSHRs)\n",
+           TIMING_WINDOW, TIMING_MSHRS);
+    printf("  -j <jobs>   Evaluate up to <jobs> functions at once (default: "
+           "one per CPU)\n");
     printf("  -M <rows>   Number of destination matrix rows (max %d)\n", MAXN);
     printf("  -N <cols>   Number of destination matrix columns (max %d)\n",
            MAXN);
@@ -227,8 +389,10 @@ int main(int argc, char *argv[]) {
 
     bool submission_only = false;
     bool use_large_cache = false;
+    bool timed = false;
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
 
-    while ((c = getopt(argc, argv, "hcslM:N:")) != -1) {
+    while ((c = getopt(argc, argv, "hcsltj:M:N:")) != -1) {
         switch (c) {
         case 'M':
             M = (size_t)atoi(optarg);
@@ -242,6 +406,16 @@ int main(int argc, char *argv[]) {
         case 'l':
             use_large_cache = true;
             break;
+        case 't':
+            timed = true;
+            break;
+        case 'j':
+            threads = atol(optarg);
+            if (threads < 1) {
+                printf("Error: -j needs at least one job\n");
+                exit(1);
+            }
+            break;
         case 'h':
             usage(argv);
             exit(0);
@@ -277,14 +451,20 @@ int main(int argc, char *argv[]) {
     /* Time out and give up after a while */
     alarm(360);
 
+    /* Every tracegen-ct writes its trace to its own pipe at TRACE_FD */
+    setenv("CONTECH_TRACE", TRACE_PATH, 1);
+    if (threads < 1)
+        threads = 1;
+
     /* Check the performance of the student's transpose function */
     if (use_large_cache) {
         /* Use Haswell L1 cache */
         eval_perf(HASWELL_L1_SET, HASWELL_L1_ASSOC, HASWELL_L1_BLOCK,
-                  submission_only);
+                  submission_only, timed, (int)threads);
     } else {
         /* Use original cache otherwise */
-        eval_perf(TEST_LOG_SET, TEST_ASSOC, TEST_LOG_BLOCK, submission_only);
+        eval_perf(TEST_LOG_SET, TEST_ASSOC, TEST_LOG_BLOCK, submission_only,
+                  timed, (int)threads);
     }
 
     /* Emit the results for this particular test */
@@ -298,17 +478,9 @@ int main(int argc, char *argv[]) {
     } else {
         printf("\nSummary for official submission (func %d): correctness=%d "
                "cycles=%ld\n",
-               results.funcid, results.correct,
-               get_clock_cycles(results.stats.hits, results.stats.misses));
+               results.funcid, results.correct, results.cycles);
         printf("\nTEST_TRANS_RESULTS=%d:%ld\n", results.correct,
-               get_clock_cycles(results.stats.hits, results.stats.misses));
-    }
-
-    /* Remove hidden trace files */
-    for (int i = 0; i < MAX_TRANS_FUNCS; i++) {
-        char traceFile[FILENAME_BUFSIZE];
-        snprintf(traceFile, sizeof(traceFile), "trace.f%d", i);
-        remove(traceFile);
+               results.cycles);
     }
 
     return status;
@@ -0,0 +1,74 @@
+/**
+ * @file timing.c
+ * @brief Cycle estimate of a trace that overlaps independent misses
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cachelab.h"
+#include "timing.h"
+
+bool timing_init(timing_t *timing, int window, int mshrs) {
+    memset(timing, 0, sizeof(*timing));
+    timing->window = window;
+    timing->mshr_count = mshrs;
+    timing->mshrs = calloc(mshrs, sizeof(timing_mshr_t));
+    timing->retired = calloc(window, sizeof(long));
+    if (timing->mshrs == NULL || timing->retired == NULL) {
+        fprintf(stderr, "Failed to allocate the timing model\n");
+        timing_free(timing);
+        return false;
+    }
+    return true;
+}
+
+void timing_access(timing_t *timing, unsigned long block, bool hit) {
+    // wait for the access window places ahead to leave the window
+    long slot = timing->accesses % timing->window;
+    long issue = timing->accesses == 0 ? 0 : timing->last_issue + 1;
+    if (timing->accesses >= timing->window && timing->retired[slot] > issue)
+        issue = timing->retired[slot];
+
+    // share the MSHR of an outstanding miss to the block, else remember
+    // the MSHR that frees up first
+    timing_mshr_t *first_free = &timing->mshrs[0];
+    long done = -1;
+    for (int i = 0; i < timing->mshr_count; i++) {
+        timing_mshr_t *mshr = &timing->mshrs[i];
+        if (mshr->done > issue && mshr->block == block) {
+            done = mshr->done;
+            break;
+        }
+        if (mshr->done < first_free->done)
+            first_free = mshr;
+    }
+
+    if (done >= 0) {
+        if (done < issue + HIT_CYCLES)
+            done = issue + HIT_CYCLES;
+    } else if (hit) {
+        done = issue + HIT_CYCLES;
+    } else {
+        long start = first_free->done > issue ? first_free->done : issue;
+        done = start + MISS_CYCLES;
+        first_free->block = block;
+        first_free->done = done;
+    }
+
+    long retire = done > timing->last_retire ? done : timing->last_retire;
+    timing->retired[slot] = retire;
+    timing->last_retire = retire;
+    timing->last_issue = issue;
+    timing->accesses = timing->accesses + 1;
+}
+
+long timing_cycles(const timing_t *timing) { return timing->last_retire; }
+
+void timing_free(timing_t *timing) {
+    free(timing->mshrs);
+    free(timing->retired);
+    timing->mshrs = NULL;
+    timing->retired = NULL;
+}
@@ -0,0 +1,67 @@
+/**
+ * @file timing.h
+ * @brief Cycle estimate of a trace that overlaps independent misses
+ *
+ * The default score of test-trans charges HIT_CYCLES for every hit and
+ * MISS_CYCLES for every miss, as if each miss waited for the one before
+ * it. This model instead runs the accesses through an out-of-order
+ * window and a set of miss status holding registers (MSHRs):
+ *
+ *   - access i issues one cycle after access i - 1, but not before access
+ *     i - window has retired
+ *   - a hit completes HIT_CYCLES after it issues
+ *   - a miss takes a free MSHR, waiting for the first one to free up if
+ *     there is none, and completes MISS_CYCLES after it gets one
+ *   - an access to a block whose miss is still outstanding, hit or miss,
+ *     shares that MSHR and completes when the block arrives, and no
+ *     earlier than HIT_CYCLES after it issues
+ *   - accesses retire in order, each once it and the one before it are
+ *     complete
+ *
+ * The trace has no data dependences, so every other access is taken to be
+ * independent. The estimate is the cycle the last access retires. With a
+ * window of 1 and one MSHR it is HIT_CYCLES * hits + MISS_CYCLES * misses.
+ */
+
+#ifndef CACHELAB_TIMING_H
+#define CACHELAB_TIMING_H
+
+#include <stdbool.h>
+
+/**
+ * @brief An MSHR and the block it is fetching
+ */
+typedef struct {
+    unsigned long block;
+    long done; /* cycle the block arrives, the MSHR is free after it */
+} timing_mshr_t;
+
+/**
+ * @brief State of the timing model of one trace
+ */
+typedef struct {
+    int window;
+    int mshr_count;
+    timing_mshr_t *mshrs;
+    long *retired; /* retire cycles of the last window accesses, a ring */
+    long accesses;
+    long last_issue;
+    long last_retire;
+} timing_t;
+
+/** @brief Start a model with this window and number of MSHRs */
+bool timing_init(timing_t *timing, int window, int mshrs);
+
+/**
+ * @brief Add the next access of the trace, to block, which hit or missed
+ * in the simulated cache
+ */
+void timing_access(timing_t *timing, unsigned long block, bool hit);
+
+/** @brief Cycles the accesses so far take */
+long timing_cycles(const timing_t *timing);
+
+/** @brief Release the window and the MSHRs */
+void timing_free(timing_t *timing);
+
+#endif /* CACHELAB_TIMING_H */
@@ -0,0 +1,85 @@
+/**
+ * @file trace-convert.c
+ * @brief Converts memory traces between the text and binary formats
+ *
+ * The input format is detected from its magic number, so the same command
+ * converts text traces such as traces/csim/long.trace to binary and
+ * binary traces back to text.
+ */
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+
+/**
+ * @brief Print usage info
+ */
+static void usage(char *argv[]) {
+    printf("Usage: %s [-h] [-f <format>] <input> <output>\n", argv[0]);
+    printf("Options:\n");
+    printf("  -h           Print this help message.\n");
+    printf("  -f <format>  Output format, text or binary (default binary)\n");
+    printf("Either file may be \"-\" for stdin or stdout.\n");
+    printf("Example: %s traces/csim/long.trace long.bin\n", argv[0]);
+}
+
+/**
+ * @brief Main routine
+ */
+int main(int argc, char *argv[]) {
+    bool binary = true;
+    int c;
+
+    while ((c = getopt(argc, argv, "hf:")) != -1) {
+        switch (c) {
+        case 'f':
+            if (strcmp(optarg, "text") == 0) {
+                binary = false;
+            } else if (strcmp(optarg, "binary") == 0) {
+                binary = true;
+            } else {
+                usage(argv);
+                exit(1);
+            }
+            break;
+        case 'h':
+            usage(argv);
+            exit(0);
+        default:
+            usage(argv);
+            exit(1);
+        }
+    }
+
+    if (argc - optind != 2) {
+        usage(argv);
+        exit(1);
+    }
+
+    trace_reader_t reader;
+    if (!trace_open(&reader, argv[optind]))
+        exit(1);
+
+    trace_writer_t writer;
+    if (!trace_writer_open(&writer, argv[optind + 1], binary)) {
+        trace_close(&reader);
+        exit(1);
+    }
+
+    trace_access_t access;
+    while (trace_next(&reader, &access))
+        trace_write(&writer, &access);
+
+    bool read = trace_close(&reader);
+    if (!trace_writer_close(&writer)) {
+        fprintf(stderr, "Error writing %s\n", argv[optind + 1]);
+        exit(1);
+    }
+    if (!read)
+        exit(1);
+    return 0;
+}
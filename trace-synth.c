@@ -0,0 +1,292 @@
+/**
+ * @file trace-synth.c
+ * @brief Generates synthetic memory traces of any length
+ *
+ * Each argument describes a phase, "<pattern>[:<key>=<value>,...]", with
+ * the patterns of synth.h and the keys:
+ *
+ *   base=<addr>    first byte of the working set or matrix (0x10000000)
+ *   span=<bytes>   working set size (1M)
+ *   stride=<bytes> stride of the stride pattern (the largest size)
+ *   n=<dim>        matrix dimension of the transpose pattern (1024)
+ *   size=<s>/<s>.. access sizes to pick from (8)
+ *   stores=<pct>   percentage of stores (0)
+ *   theta=<exp>    Zipf exponent (0.99)
+ *   len=<count>    accesses before the next phase starts
+ *
+ * Numbers may end in K, M or G for 2^10, 2^20 or 2^30. The phases run in
+ * turn, each continuing its own stream where it left off, until -n
+ * accesses have been written; without -n, every phase runs once. The same
+ * arguments and seed always give the same trace, so it can be piped into
+ * csim instead of being stored:
+ *
+ *     ./trace-synth -n 1G zipf:span=256M | ./csim -s 10 -E 8 -b 6 -t -
+ */
+
+#include <getopt.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "synth.h"
+#include "trace.h"
+
+/** @brief Most phases a trace can have */
+#define MAX_PHASES 16
+
+/** @brief Accesses generated and written at a time */
+#define SYNTH_BATCH 4096
+
+/**
+ * @brief A pattern and how many accesses it runs for at a time
+ */
+typedef struct {
+    synth_t gen;
+    long length; /* 0 for as long as the trace lasts */
+} phase_t;
+
+/**
+ * @brief Print usage info
+ */
+static void usage(char *argv[]) {
+    printf("Usage: %s [-h] [-f <format>] [-n <count>] [-s <seed>] "
+           "[-o <output>] <phase>...\n",
+           argv[0]);
+    printf("Options:\n");
+    printf("  -h           Print this help message.\n");
+    printf("  -f <format>  Output format, text or binary (default text)\n");
+    printf("  -n <count>   Accesses to write (default one run of every "
+           "phase)\n");
+    printf("  -s <seed>    Seed of the random choices (default 1)\n");
+    printf("  -o <output>  Output file (default \"-\" for stdout)\n");
+    printf("A phase is <pattern>[:<key>=<value>,...], the patterns are "
+           "stride, random,\nzipf and transpose, the keys base, span, "
+           "stride, n, size, stores, theta\nand len; see trace-synth.c.\n");
+    printf("Example: %s -n 1M stride:stride=64,len=1000 zipf:span=16M\n",
+           argv[0]);
+}
+
+/**
+ * @brief Parse a number with an optional K, M or G suffix
+ */
+static bool parse_number(const char *text, unsigned long *value) {
+    char *end;
+    *value = strtoul(text, &end, 0);
+    if (end == text)
+        return false;
+    int shift = 0;
+    if (*end == 'K' || *end == 'k')
+        shift = 10;
+    else if (*end == 'M' || *end == 'm')
+        shift = 20;
+    else if (*end == 'G' || *end == 'g')
+        shift = 30;
+    if (shift != 0) {
+        end = end + 1;
+        *value = *value << shift;
+    }
+    return *end == '\0';
+}
+
+/**
+ * @brief Parse one key=value of a phase into config and *length
+ */
+static bool parse_key(synth_config_t *config, long *length, char *item) {
+    char *value = strchr(item, '=');
+    if (value == NULL)
+        return false;
+    *value = '\0';
+    value = value + 1;
+
+    unsigned long number = 0;
+    if (strcmp(item, "theta") == 0) {
+        char *end;
+        config->theta = strtod(value, &end);
+        return end != value && *end == '\0';
+    }
+    if (strcmp(item, "size") == 0) {
+        config->size_count = 0;
+        for (char *size = strtok(value, "/"); size;
+             size = strtok(NULL, "/")) {
+            if (config->size_count == SYNTH_MAX_SIZES ||
+                !parse_number(size, &number) || number > UINT_MAX)
+                return false;
+            config->sizes[config->size_count] = (unsigned int)number;
+            config->size_count = config->size_count + 1;
+        }
+        return config->size_count > 0;
+    }
+
+    if (!parse_number(value, &number))
+        return false;
+    if (strcmp(item, "base") == 0)
+        config->base = number;
+    else if (strcmp(item, "span") == 0)
+        config->span = number;
+    else if (strcmp(item, "stride") == 0)
+        config->stride = number;
+    else if (strcmp(item, "n") == 0)
+        config->n = (long)number;
+    else if (strcmp(item, "stores") == 0 && number <= 100)
+        config->store_percent = (int)number;
+    else if (strcmp(item, "len") == 0 && number <= LONG_MAX)
+        *length = (long)number;
+    else
+        return false;
+    return true;
+}
+
+/**
+ * @brief Parse the phase spec into phase, with the seed of its choices
+ */
+static bool parse_phase(phase_t *phase, const char *spec,
+                        unsigned long seed) {
+    char copy[256];
+    if (strlen(spec) >= sizeof(copy))
+        return false;
+    strcpy(copy, spec);
+
+    synth_config_t config;
+    memset(&config, 0, sizeof(config));
+    config.base = 0x10000000;
+    config.span = 1UL << 20;
+    config.n = 1024;
+    config.sizes[0] = 8;
+    config.size_count = 1;
+    config.theta = 0.99;
+    config.seed = seed;
+    phase->length = 0;
+
+    char *keys = strchr(copy, ':');
+    if (keys) {
+        *keys = '\0';
+        keys = keys + 1;
+    }
+    if (!synth_parse_pattern(&config.pattern, copy))
+        return false;
+
+    // strtok is busy with the keys, so each key is cut out by hand
+    while (keys && *keys) {
+        char *next = strchr(keys, ',');
+        if (next) {
+            *next = '\0';
+            next = next + 1;
+        }
+        if (!parse_key(&config, &phase->length, keys))
+            return false;
+        keys = next;
+    }
+
+    // a stride defaults to the largest size, a sequential scan
+    if (config.stride == 0) {
+        for (int i = 0; i < config.size_count; i++) {
+            if (config.sizes[i] > config.stride)
+                config.stride = config.sizes[i];
+        }
+    }
+    return synth_init(&phase->gen, &config);
+}
+
+/**
+ * @brief Main routine
+ */
+int main(int argc, char *argv[]) {
+    bool binary = false;
+    const char *output = "-";
+    unsigned long count = 0;
+    unsigned long seed = 1;
+    bool counted = false;
+    int c;
+
+    while ((c = getopt(argc, argv, "hf:n:s:o:")) != -1) {
+        switch (c) {
+        case 'f':
+            if (strcmp(optarg, "text") == 0) {
+                binary = false;
+            } else if (strcmp(optarg, "binary") == 0) {
+                binary = true;
+            } else {
+                usage(argv);
+                exit(1);
+            }
+            break;
+        case 'n':
+            if (!parse_number(optarg, &count)) {
+                usage(argv);
+                exit(1);
+            }
+            counted = true;
+            break;
+        case 's':
+            if (!parse_number(optarg, &seed)) {
+                usage(argv);
+                exit(1);
+            }
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        case 'h':
+            usage(argv);
+            exit(0);
+        default:
+            usage(argv);
+            exit(1);
+        }
+    }
+
+    int phase_count = argc - optind;
+    if (phase_count < 1 || phase_count > MAX_PHASES) {
+        usage(argv);
+        exit(1);
+    }
+    static phase_t phases[MAX_PHASES];
+    unsigned long one_round = 0;
+    for (int i = 0; i < phase_count; i++) {
+        if (!parse_phase(&phases[i], argv[optind + i], seed + i)) {
+            fprintf(stderr, "Invalid phase: %s\n", argv[optind + i]);
+            exit(1);
+        }
+        // only the last phase may run on forever
+        if (phases[i].length == 0 && (i < phase_count - 1 || !counted)) {
+            fprintf(stderr, "Phase %s needs len=<count>%s\n",
+                    argv[optind + i], counted ? "" : ", or give -n");
+            exit(1);
+        }
+        one_round = one_round + phases[i].length;
+    }
+    if (!counted)
+        count = one_round;
+
+    trace_writer_t writer;
+    if (!trace_writer_open(&writer, output, binary))
+        exit(1);
+
+    static trace_access_t batch[SYNTH_BATCH];
+    int current = 0;
+    long left = phases[0].length > 0 ? phases[0].length : LONG_MAX;
+    while (count > 0) {
+        long n = SYNTH_BATCH;
+        if ((unsigned long)n > count)
+            n = (long)count;
+        if (n > left)
+            n = left;
+        synth_fill(&phases[current].gen, batch, (int)n);
+        trace_write_batch(&writer, batch, (int)n);
+        count = count - n;
+        left = left - n;
+        if (left == 0) {
+            current = (current + 1) % phase_count;
+            left = phases[current].length > 0 ? phases[current].length
+                                               : LONG_MAX;
+        }
+    }
+
+    if (!trace_writer_close(&writer)) {
+        fprintf(stderr, "Error writing %s\n", output);
+        exit(1);
+    }
+    return 0;
+}
@@ -0,0 +1,764 @@
+/**
+ * @file trace.c
+ * @brief Reading and writing memory traces in the text and binary formats
+ */
+
+#define _DEFAULT_SOURCE /* for madvise */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+/** @brief Longest encoded access: a text line with a 16-digit address and
+ * a 10-digit size, or a binary record */
+#define MAX_ENCODED 32
+
+/** @brief Bytes trace_write_batch() encodes before handing them to stdio */
+#define WRITE_CHUNK (64 * 1024)
+
+/** @brief One more than the value of each hex digit, 0 for every other
+ * byte, so the table is complete at compile time and safe to share */
+static const unsigned char hex_digit[256] = {
+    ['0'] = 1,  ['1'] = 2,  ['2'] = 3,  ['3'] = 4,  ['4'] = 5,  ['5'] = 6,
+    ['6'] = 7,  ['7'] = 8,  ['8'] = 9,  ['9'] = 10, ['a'] = 11, ['b'] = 12,
+    ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16, ['A'] = 11, ['B'] = 12,
+    ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16,
+};
+
+/**
+ * @brief Decode one text line "op addr,size" in [line, end)
+ *
+ * @return false if the line holds no access
+ */
+static bool parse_line(const char *line, const char *end,
+                       trace_access_t *access) {
+    const char *p = line;
+    while (p < end && (*p == ' ' || *p == '\t'))
+        p++;
+    if (p == end)
+        return false;
+    char c = *p++;
+    while (p < end && *p == ' ')
+        p++;
+
+    // an optional 0x, as sscanf("%lx") took it
+    if (end - p > 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X'))
+        p += 2;
+
+    // one table lookup per digit, the loop exits on the ','
+    unsigned long addr = 0;
+    unsigned char digit;
+    while (p < end && (digit = hex_digit[(unsigned char)*p]) != 0) {
+        addr = (addr << 4) | (digit - 1u);
+        p++;
+    }
+
+    unsigned int size = 0;
+    if (p < end && *p == ',') {
+        for (p++; p < end && (unsigned)(*p - '0') < 10; p++)
+            size = size * 10 + (*p - '0');
+    }
+
+    access->addr = addr;
+    access->size = size;
+    access->is_load = (c != 'S');
+    access->continued = false;
+    return true;
+}
+
+/**
+ * @brief Keep the unread bytes and read more behind them
+ */
+static void refill(trace_reader_t *reader) {
+    memmove(reader->buffer, reader->buffer + reader->pos,
+            reader->len - reader->pos);
+    reader->len = reader->len - reader->pos;
+    reader->pos = 0;
+
+    while (reader->len < TRACE_BUFFER_SIZE) {
+        ssize_t n = read(reader->fd, reader->buffer + reader->len,
+                         TRACE_BUFFER_SIZE - reader->len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            if (n < 0) {
+                fprintf(stderr, "Error reading trace: %s\n", strerror(errno));
+                reader->failed = true;
+            }
+            reader->eof = true;
+            return;
+        }
+        reader->len = reader->len + n;
+        // a block is enough, do not wait for a pipe to fill the buffer
+        if (reader->len - reader->pos >= TRACE_MAX_RECORD)
+            return;
+    }
+}
+
+/**
+ * @brief Get the next text line as [*line, *end), without the newline
+ *
+ * @return false at the end of the trace
+ */
+static bool next_line(trace_reader_t *reader, const char **line,
+                      const char **end) {
+    while (true) {
+        char *start = reader->buffer + reader->pos;
+        char *newline = memchr(start, '\n', reader->len - reader->pos);
+
+        if (newline && reader->skip_rest) {
+            // tail of an overlong line
+            reader->skip_rest = false;
+            reader->pos = newline + 1 - reader->buffer;
+            continue;
+        }
+        if (newline) {
+            *line = start;
+            *end = newline;
+            reader->pos = newline + 1 - reader->buffer;
+            return true;
+        }
+
+        if (reader->eof) {
+            // last line without a newline
+            if (reader->pos == reader->len || reader->skip_rest)
+                return false;
+            *line = start;
+            *end = reader->buffer + reader->len;
+            reader->pos = reader->len;
+            return true;
+        }
+
+        if (reader->skip_rest) {
+            reader->pos = reader->len = 0;
+        } else if (reader->pos == 0 && reader->len == TRACE_BUFFER_SIZE) {
+            // hand out the part that fits, then drop the rest
+            *line = start;
+            *end = reader->buffer + reader->len;
+            reader->pos = reader->len = 0;
+            reader->skip_rest = true;
+            return true;
+        }
+        refill(reader);
+    }
+}
+
+/**
+ * @brief Read a LEB128 varint at *p, advancing *p past it
+ */
+static inline uint64_t get_varint(const unsigned char **p,
+                                  const unsigned char *end) {
+    uint64_t value = 0;
+    for (int shift = 0; *p < end && shift < 64; shift += 7) {
+        unsigned char byte = *(*p)++;
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0)
+            break;
+    }
+    return value;
+}
+
+/**
+ * @brief Decode the next binary record
+ */
+static bool next_record(trace_reader_t *reader, trace_access_t *access) {
+    if (reader->len - reader->pos < TRACE_MAX_RECORD && !reader->eof)
+        refill(reader);
+    if (reader->pos == reader->len)
+        return false;
+
+    const unsigned char *p = (unsigned char *)reader->buffer + reader->pos;
+    const unsigned char *end = (unsigned char *)reader->buffer + reader->len;
+    unsigned char head = *p++;
+    unsigned int size = head >> 1;
+    if (size == TRACE_SIZE_ESCAPE)
+        size = (unsigned int)get_varint(&p, end);
+    uint64_t zigzag = get_varint(&p, end);
+    uint64_t delta = (zigzag >> 1) ^ -(zigzag & 1);
+
+    reader->prev_addr = reader->prev_addr + delta;
+    access->addr = reader->prev_addr;
+    access->size = size;
+    access->is_load = (head & 1) == 0;
+    access->continued = false;
+    reader->pos = (const char *)p - reader->buffer;
+    return true;
+}
+
+/**
+ * @brief The decoded accesses of one chunk
+ */
+typedef struct {
+    trace_access_t *records;
+    long count;
+    long capacity;
+    long chunk; /* index of the chunk held, or -1 */
+    bool ready; /* records holds all of chunk */
+} trace_slot_t;
+
+/**
+ * @brief Decoder threads of a reader. Chunk i is decoded into slot i %
+ * slot_count once chunk i - slot_count has been released by the reader, so
+ * the decoders run at most slot_count chunks ahead.
+ */
+struct trace_pipeline {
+    pthread_mutex_t lock;
+    pthread_cond_t changed; /* a slot got ready or free, or stop was set */
+    const char *text;
+    size_t start; /* [start, end) of text is decoded */
+    size_t end;
+    long chunk_count;
+    long next_chunk; /* next chunk a decoder takes */
+    long next_out;   /* next chunk the reader takes */
+    bool holding;    /* the reader uses the slot of next_out */
+    bool stop;
+    bool failed; /* a decoder ran out of memory */
+    trace_slot_t *slots;
+    int slot_count;
+    pthread_t threads[TRACE_MAX_DECODERS];
+    int thread_count;
+};
+
+/**
+ * @brief Offset of the first line of chunk, just after the newline at or
+ * past its nominal start
+ */
+static size_t chunk_start(const trace_pipeline_t *p, long chunk) {
+    if (chunk == 0)
+        return p->start;
+    if (chunk >= p->chunk_count)
+        return p->end;
+    size_t from = p->start + (size_t)chunk * TRACE_CHUNK_SIZE - 1;
+    const char *newline = memchr(p->text + from, '\n', p->end - from);
+    return newline ? (size_t)(newline + 1 - p->text) : p->end;
+}
+
+/**
+ * @brief Decode the lines of chunk into slot. Return false if the records
+ * could not grow.
+ */
+static bool decode_chunk(const trace_pipeline_t *p, long chunk,
+                         trace_slot_t *slot) {
+    const char *line = p->text + chunk_start(p, chunk);
+    const char *end = p->text + chunk_start(p, chunk + 1);
+    slot->count = 0;
+    while (line < end) {
+        const char *newline = memchr(line, '\n', end - line);
+        const char *line_end = newline ? newline : end;
+        if (slot->count == slot->capacity) {
+            long capacity = slot->capacity ? 2 * slot->capacity
+                                           : TRACE_CHUNK_SIZE / 16;
+            trace_access_t *records =
+                realloc(slot->records, capacity * sizeof(trace_access_t));
+            if (records == NULL)
+                return false;
+            slot->records = records;
+            slot->capacity = capacity;
+        }
+        if (parse_line(line, line_end, &slot->records[slot->count]))
+            slot->count = slot->count + 1;
+        line = line_end + 1;
+    }
+    return true;
+}
+
+/**
+ * @brief Body of a decoder thread, arg is its trace_pipeline_t
+ */
+static void *decode_worker(void *arg) {
+    trace_pipeline_t *p = arg;
+    pthread_mutex_lock(&p->lock);
+    for (;;) {
+        while (!p->stop && p->next_chunk < p->chunk_count &&
+               p->next_chunk >= p->next_out + p->slot_count)
+            pthread_cond_wait(&p->changed, &p->lock);
+        if (p->stop || p->next_chunk >= p->chunk_count)
+            break;
+        long chunk = p->next_chunk;
+        p->next_chunk = p->next_chunk + 1;
+        trace_slot_t *slot = &p->slots[chunk % p->slot_count];
+        pthread_mutex_unlock(&p->lock);
+
+        // the slot is this thread's until it is marked ready
+        bool decoded = decode_chunk(p, chunk, slot);
+
+        pthread_mutex_lock(&p->lock);
+        if (!decoded) {
+            slot->count = 0;
+            p->failed = true;
+        }
+        slot->chunk = chunk;
+        slot->ready = true;
+        pthread_cond_broadcast(&p->changed);
+    }
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
+}
+
+/**
+ * @brief Release the chunk the reader holds and wait for the next one that
+ * holds accesses. Return how many it holds, 0 at the end, where *failed
+ * tells whether a decoder ended the trace early.
+ */
+static long pipeline_take(trace_pipeline_t *p, const trace_access_t **run,
+                          bool *failed) {
+    long count = 0;
+    pthread_mutex_lock(&p->lock);
+    while (count == 0) {
+        if (p->holding) {
+            p->slots[p->next_out % p->slot_count].ready = false;
+            p->next_out = p->next_out + 1;
+            p->holding = false;
+            pthread_cond_broadcast(&p->changed);
+        }
+        if (p->next_out >= p->chunk_count)
+            break;
+
+        trace_slot_t *slot = &p->slots[p->next_out % p->slot_count];
+        while (!(slot->ready && slot->chunk == p->next_out))
+            pthread_cond_wait(&p->changed, &p->lock);
+        if (p->failed) {
+            fprintf(stderr, "Failed to allocate decoded accesses\n");
+            *failed = true;
+            break;
+        }
+        p->holding = true;
+        *run = slot->records;
+        count = slot->count;
+    }
+    pthread_mutex_unlock(&p->lock);
+    return count;
+}
+
+/**
+ * @brief Stop the decoder threads and release the pipeline
+ */
+static void pipeline_free(trace_pipeline_t *p) {
+    pthread_mutex_lock(&p->lock);
+    p->stop = true;
+    pthread_cond_broadcast(&p->changed);
+    pthread_mutex_unlock(&p->lock);
+    for (int i = 0; i < p->thread_count; i++)
+        pthread_join(p->threads[i], NULL);
+
+    for (int i = 0; i < p->slot_count; i++)
+        free(p->slots[i].records);
+    free(p->slots);
+    pthread_cond_destroy(&p->changed);
+    pthread_mutex_destroy(&p->lock);
+    free(p);
+}
+
+/**
+ * @brief Decode the next access of the trace, as it is in the file
+ */
+static bool decode_next(trace_reader_t *reader, trace_access_t *access) {
+    if (reader->binary)
+        return next_record(reader, access);
+
+    const char *line, *end;
+    while (next_line(reader, &line, &end)) {
+        if (parse_line(line, end, access))
+            return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Next run of accesses as they are in the file, 0 at the end
+ */
+static long decode_run(trace_reader_t *reader, const trace_access_t **run) {
+    if (reader->pipeline)
+        return pipeline_take(reader->pipeline, run, &reader->failed);
+
+    if (reader->run == NULL) {
+        reader->run = malloc(TRACE_RUN_SIZE * sizeof(trace_access_t));
+        if (reader->run == NULL) {
+            fprintf(stderr, "Failed to allocate trace buffer\n");
+            reader->failed = true;
+            return 0;
+        }
+    }
+    long count = 0;
+    while (count < TRACE_RUN_SIZE && decode_next(reader, &reader->run[count]))
+        count = count + 1;
+    *run = reader->run;
+    return count;
+}
+
+/**
+ * @brief Last byte of access, the top of the address space for an access
+ * that would wrap past it
+ */
+static inline unsigned long last_byte(const trace_access_t *access) {
+    if (access->size == 0)
+        return access->addr;
+    unsigned long last = access->addr + (access->size - 1);
+    return last < access->addr ? ULONG_MAX : last;
+}
+
+/**
+ * @brief True if access touches more than one block of 2^b bytes
+ */
+static inline bool straddles(const trace_access_t *access, int b) {
+    return ((access->addr ^ last_byte(access)) >> b) != 0;
+}
+
+/**
+ * @brief Next run of accesses with each straddling access split at block
+ * boundaries, 0 at the end.
+ *
+ * Accesses that fit in a block are handed out in place; only from a
+ * straddling access on are they copied into split_run, one per block.
+ */
+static long split_next_run(trace_reader_t *reader,
+                           const trace_access_t **run) {
+    if (reader->raw_count == 0) {
+        reader->raw_count = decode_run(reader, &reader->raw);
+        reader->split_block = 0;
+        if (reader->raw_count == 0)
+            return 0;
+    }
+    int b = reader->split_bits;
+    const trace_access_t *raw = reader->raw;
+    long count = 0;
+    if (reader->split_block == 0) {
+        while (count < reader->raw_count && !straddles(&raw[count], b))
+            count = count + 1;
+    }
+    if (count > 0) {
+        *run = raw;
+        reader->raw = raw + count;
+        reader->raw_count = reader->raw_count - count;
+        return count;
+    }
+
+    if (reader->split_run == NULL) {
+        reader->split_run = malloc(TRACE_RUN_SIZE * sizeof(trace_access_t));
+        if (reader->split_run == NULL) {
+            fprintf(stderr, "Failed to allocate trace buffer\n");
+            reader->failed = true;
+            return 0;
+        }
+    }
+    trace_access_t *out = reader->split_run;
+    while (count < TRACE_RUN_SIZE && reader->raw_count > 0) {
+        const trace_access_t *access = reader->raw;
+        unsigned long first_block = access->addr >> b;
+        unsigned long last = last_byte(access);
+        unsigned long last_block = last >> b;
+        unsigned long block = reader->split_block;
+        if (block == 0)
+            block = first_block;
+
+        // the pieces are [max(addr, block start), min(last, block end)],
+        // at least one per access; block never steps past last_block, so
+        // it cannot wrap at the top of the address space
+        for (;;) {
+            unsigned long start = block << b;
+            if (start < access->addr)
+                start = access->addr;
+            unsigned long stop =
+                block == last_block ? last : ((block + 1) << b) - 1;
+            out[count].addr = start;
+            out[count].size = access->size ? (unsigned int)(stop - start + 1)
+                                           : 0;
+            out[count].is_load = access->is_load;
+            out[count].continued = block != first_block;
+            count = count + 1;
+            if (block == last_block || count == TRACE_RUN_SIZE)
+                break;
+            block = block + 1;
+        }
+        if (block != last_block) {
+            reader->split_block = block + 1; // resume here on the next call
+            break;
+        }
+        reader->split_block = 0;
+        reader->raw = reader->raw + 1;
+        reader->raw_count = reader->raw_count - 1;
+    }
+    *run = out;
+    return count;
+}
+
+/**
+ * @brief Next run of accesses, split into blocks if trace_split_blocks()
+ * asked for it
+ */
+static long take_run(trace_reader_t *reader, const trace_access_t **run) {
+    if (reader->split)
+        return split_next_run(reader, run);
+    return decode_run(reader, run);
+}
+
+bool trace_decode_parallel(trace_reader_t *reader, int threads) {
+    if (!reader->mapped || reader->binary || reader->pipeline || threads < 1)
+        return false;
+    if (threads > TRACE_MAX_DECODERS)
+        threads = TRACE_MAX_DECODERS;
+
+    trace_pipeline_t *p = calloc(1, sizeof(trace_pipeline_t));
+    if (p == NULL)
+        return false;
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->changed, NULL);
+    p->text = reader->buffer;
+    p->start = reader->pos;
+    p->end = reader->len;
+    p->chunk_count =
+        (long)((p->end - p->start + TRACE_CHUNK_SIZE - 1) / TRACE_CHUNK_SIZE);
+
+    // two chunks per thread keep every thread busy while the reader is
+    // still on an earlier chunk
+    p->slot_count = 2 * threads;
+    p->slots = calloc(p->slot_count, sizeof(trace_slot_t));
+    if (p->slots == NULL) {
+        pipeline_free(p);
+        return false;
+    }
+    for (int i = 0; i < p->slot_count; i++)
+        p->slots[i].chunk = -1;
+    for (int i = 0; i < threads; i++) {
+        if (pthread_create(&p->threads[i], NULL, decode_worker, p) != 0)
+            break;
+        p->thread_count = p->thread_count + 1;
+    }
+    if (p->thread_count == 0) {
+        pipeline_free(p);
+        return false;
+    }
+
+    // everything the reader had not read yet now comes from the pipeline
+    reader->pos = reader->len;
+    reader->pipeline = p;
+    return true;
+}
+
+long trace_next_run(trace_reader_t *reader, const trace_access_t **run) {
+    // finish the run trace_next() started
+    if (reader->pending_count > 0) {
+        long count = reader->pending_count;
+        *run = reader->pending;
+        reader->pending_count = 0;
+        return count;
+    }
+    return take_run(reader, run);
+}
+
+void trace_split_blocks(trace_reader_t *reader, int b) {
+    reader->split = true;
+    reader->split_bits = b;
+}
+
+bool trace_open(trace_reader_t *reader, const char *file_name) {
+    int fd = STDIN_FILENO;
+    if (strcmp(file_name, "-") != 0) {
+        fd = open(file_name, O_RDONLY);
+        if (fd < 0) {
+            fprintf(stderr, "Error opening trace file %s: %s\n", file_name,
+                    strerror(errno));
+            return false;
+        }
+    }
+    return trace_open_fd(reader, fd);
+}
+
+bool trace_open_fd(trace_reader_t *reader, int fd) {
+    memset(reader, 0, sizeof(*reader));
+    reader->fd = fd;
+
+    struct stat st;
+    bool regular = fstat(reader->fd, &st) == 0 && S_ISREG(st.st_mode);
+    reader->eof = true;
+    if (regular && st.st_size > 0) {
+        // the whole trace is in memory, nothing is ever refilled
+        void *map =
+            mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, reader->fd, 0);
+        if (map != MAP_FAILED) {
+            madvise(map, st.st_size, MADV_SEQUENTIAL);
+            reader->mapped = true;
+            reader->buffer = map;
+            reader->len = st.st_size;
+        }
+    }
+    if (!reader->mapped && !(regular && st.st_size == 0)) {
+        reader->buffer = malloc(TRACE_BUFFER_SIZE);
+        if (reader->buffer == NULL) {
+            fprintf(stderr, "Failed to allocate trace buffer\n");
+            trace_close(reader);
+            return false;
+        }
+        reader->eof = false;
+        refill(reader);
+    }
+
+    // detect the format
+    if (reader->len >= TRACE_HEADER_SIZE &&
+        memcmp(reader->buffer, TRACE_MAGIC, sizeof(TRACE_MAGIC)) == 0) {
+        const unsigned char *h = (unsigned char *)reader->buffer;
+        uint32_t version = 0;
+        for (int i = 3; i >= 0; i--)
+            version = version << 8 | h[8 + i];
+        if (version != TRACE_VERSION) {
+            fprintf(stderr, "Unsupported binary trace version %u\n", version);
+            trace_close(reader);
+            return false;
+        }
+        reader->binary = true;
+        reader->pos = TRACE_HEADER_SIZE;
+    }
+    return true;
+}
+
+bool trace_next(trace_reader_t *reader, trace_access_t *access) {
+    if (reader->pipeline == NULL && !reader->split)
+        return decode_next(reader, access);
+
+    if (reader->pending_count == 0) {
+        reader->pending_count = take_run(reader, &reader->pending);
+        if (reader->pending_count == 0)
+            return false;
+    }
+    *access = *reader->pending;
+    reader->pending = reader->pending + 1;
+    reader->pending_count = reader->pending_count - 1;
+    return true;
+}
+
+bool trace_close(trace_reader_t *reader) {
+    if (reader->pipeline)
+        pipeline_free(reader->pipeline);
+    free(reader->run);
+    free(reader->split_run);
+    reader->pipeline = NULL;
+    reader->run = NULL;
+    reader->split_run = NULL;
+    if (reader->mapped)
+        munmap(reader->buffer, reader->len);
+    else
+        free(reader->buffer);
+    reader->buffer = NULL;
+    if (reader->fd != STDIN_FILENO)
+        close(reader->fd);
+    return !reader->failed;
+}
+
+bool trace_writer_open(trace_writer_t *writer, const char *file_name,
+                       bool binary) {
+    memset(writer, 0, sizeof(*writer));
+    writer->binary = binary;
+    if (strcmp(file_name, "-") == 0) {
+        writer->stream = stdout;
+    } else {
+        writer->stream = fopen(file_name, "w");
+        if (writer->stream == NULL) {
+            fprintf(stderr, "Error creating trace file %s: %s\n", file_name,
+                    strerror(errno));
+            return false;
+        }
+    }
+
+    if (binary) {
+        unsigned char header[TRACE_HEADER_SIZE] = {0};
+        memcpy(header, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+        for (int i = 0; i < 4; i++)
+            header[8 + i] = (TRACE_VERSION >> (8 * i)) & 0xff;
+        fwrite(header, 1, sizeof(header), writer->stream);
+    }
+    return true;
+}
+
+/**
+ * @brief Append a LEB128 varint to buf, return the number of bytes used
+ */
+static int put_varint(unsigned char *buf, uint64_t value) {
+    int n = 0;
+    while (value >= 0x80) {
+        buf[n++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    buf[n++] = (unsigned char)value;
+    return n;
+}
+
+/**
+ * @brief Encode one access in the format of writer into buf, return the
+ * number of bytes used, at most MAX_ENCODED
+ */
+static size_t encode_access(trace_writer_t *writer,
+                            const trace_access_t *access, unsigned char *buf) {
+    if (!writer->binary) {
+        static const char digits[] = "0123456789abcdef";
+        char tmp[20];
+        size_t n = 0;
+        buf[n++] = access->is_load ? 'L' : 'S';
+        buf[n++] = ' ';
+        int len = 0;
+        unsigned long addr = access->addr;
+        do {
+            tmp[len++] = digits[addr & 0xf];
+            addr >>= 4;
+        } while (addr != 0);
+        while (len > 0)
+            buf[n++] = tmp[--len];
+        buf[n++] = ',';
+        unsigned int size = access->size;
+        do {
+            tmp[len++] = (char)('0' + size % 10);
+            size /= 10;
+        } while (size != 0);
+        while (len > 0)
+            buf[n++] = tmp[--len];
+        buf[n++] = '\n';
+        return n;
+    }
+
+    size_t n = 1;
+    unsigned int size = access->size;
+    if (size >= TRACE_SIZE_ESCAPE) {
+        n += put_varint(buf + n, size);
+        size = TRACE_SIZE_ESCAPE;
+    }
+    buf[0] = (unsigned char)(size << 1 | (access->is_load ? 0 : 1));
+
+    int64_t delta = (int64_t)(access->addr - writer->prev_addr);
+    n += put_varint(buf + n, ((uint64_t)delta << 1) ^ (delta >> 63));
+    writer->prev_addr = access->addr;
+    return n;
+}
+
+void trace_write(trace_writer_t *writer, const trace_access_t *access) {
+    trace_write_batch(writer, access, 1);
+}
+
+void trace_write_batch(trace_writer_t *writer, const trace_access_t *accesses,
+                       int count) {
+    unsigned char buf[WRITE_CHUNK];
+    size_t len = 0;
+    for (int i = 0; i < count; i++) {
+        if (len + MAX_ENCODED > sizeof(buf)) {
+            fwrite(buf, 1, len, writer->stream);
+            len = 0;
+        }
+        len += encode_access(writer, &accesses[i], buf + len);
+    }
+    fwrite(buf, 1, len, writer->stream);
+}
+
+bool trace_writer_close(trace_writer_t *writer) {
+    bool ok = !ferror(writer->stream);
+    if (writer->stream == stdout)
+        ok = fflush(stdout) == 0 && ok;
+    else
+        ok = fclose(writer->stream) == 0 && ok;
+    return ok;
+}
@@ -0,0 +1,169 @@
+/**
+ * @file trace.h
+ * @brief Reading and writing memory traces in the text and binary formats
+ *
+ * A text trace has one access per line, "L 00602260,4" or "S 7ff000398,8",
+ * the address in hex with an optional 0x.
+ * A binary trace starts with a TRACE_HEADER_SIZE byte header holding
+ * TRACE_MAGIC and the format version, followed by one variable-length
+ * record per access:
+ *
+ *   - a head byte: bit 0 is set for a store, bits 1-7 hold the size, with
+ *     TRACE_SIZE_ESCAPE meaning the size follows as a varint
+ *   - the zigzag-encoded difference from the previous address as a LEB128
+ *     varint, the first record being relative to address 0
+ *
+ * Readers detect the format from the magic number.
+ *
+ * A mapped text trace can be decoded by threads of its own: the text is
+ * split into TRACE_CHUNK_SIZE byte ranges, each starting after a newline,
+ * which are decoded in parallel a bounded number of chunks ahead of the
+ * reader and handed out in trace order.
+ */
+
+#ifndef CACHELAB_TRACE_H
+#define CACHELAB_TRACE_H
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/** @brief First bytes of every binary trace */
+#define TRACE_MAGIC "CSIMTRC"
+
+/** @brief Version written into new binary traces */
+#define TRACE_VERSION 1
+
+/** @brief Size of the binary trace header in bytes */
+#define TRACE_HEADER_SIZE 16
+
+/** @brief Head byte size field value that means an explicit size follows */
+#define TRACE_SIZE_ESCAPE 127
+
+/** @brief Longest possible binary record: head byte and two varints */
+#define TRACE_MAX_RECORD 21
+
+/** @brief Size of the block buffer used for pipes and stdin */
+#define TRACE_BUFFER_SIZE (1 << 20)
+
+/** @brief Most accesses a run holds when there are no decoder threads */
+#define TRACE_RUN_SIZE 1024
+
+/** @brief Bytes of text a decoder thread decodes at a time */
+#define TRACE_CHUNK_SIZE (4 << 20)
+
+/** @brief Most decoder threads of one reader */
+#define TRACE_MAX_DECODERS 64
+
+/**
+ * @brief One decoded memory access
+ */
+typedef struct {
+    unsigned long addr; /* first byte accessed */
+    unsigned int size;  /* number of bytes accessed */
+    bool is_load;       /* false for stores */
+    bool continued;     /* a later block of the access before it, see
+                           trace_split_blocks() */
+} trace_access_t;
+
+/** @brief Decoder threads and their chunks, private to trace.c */
+typedef struct trace_pipeline trace_pipeline_t;
+
+/**
+ * @brief Reader over a text or binary trace.
+ *
+ * A regular file is mapped whole and decoded in place; pipes and stdin are
+ * read in TRACE_BUFFER_SIZE blocks. Text lines that do not fit in the
+ * buffer are truncated to it and the rest is skipped.
+ */
+typedef struct {
+    int fd;
+    bool mapped;             /* buffer is a read-only mapping of the file */
+    bool binary;             /* the trace is in the binary format */
+    char *buffer;
+    size_t pos;              /* start of the unread bytes */
+    size_t len;              /* end of the valid bytes */
+    bool skip_rest;          /* discard bytes up to the next newline */
+    bool eof;                /* no more bytes will be read into buffer */
+    unsigned long prev_addr; /* base of the next binary address delta */
+    bool failed;             /* the trace ended early on an error */
+
+    /* trace_next_run() state */
+    trace_pipeline_t *pipeline;    /* NULL without decoder threads */
+    trace_access_t *run;           /* run buffer without decoder threads */
+    const trace_access_t *pending; /* rest of the run trace_next() is in */
+    long pending_count;
+
+    /* trace_split_blocks() state */
+    bool split;
+    int split_bits;            /* log2 of the block size */
+    const trace_access_t *raw; /* accesses not split yet */
+    long raw_count;
+    unsigned long split_block; /* next block of raw[0], 0 for its first */
+    trace_access_t *split_run; /* split accesses */
+} trace_reader_t;
+
+/**
+ * @brief Writer of a text or binary trace
+ */
+typedef struct {
+    FILE *stream;
+    bool binary;
+    unsigned long prev_addr;
+} trace_writer_t;
+
+/** @brief Open a trace for reading, "-" is stdin */
+bool trace_open(trace_reader_t *reader, const char *file_name);
+
+/**
+ * @brief Read a trace from an open descriptor, such as the read end of a
+ * pipe. trace_close() closes it.
+ */
+bool trace_open_fd(trace_reader_t *reader, int fd);
+
+/** @brief Decode the next access. Return false at the end of the trace. */
+bool trace_next(trace_reader_t *reader, trace_access_t *access);
+
+/**
+ * @brief Decode the rest of a mapped text trace on threads decoder threads.
+ * Return false, and keep decoding in the calling thread, if the trace is
+ * binary or not mapped or the threads could not start.
+ */
+bool trace_decode_parallel(trace_reader_t *reader, int threads);
+
+/**
+ * @brief Point *run at the next accesses of the trace and return how many
+ * there are, 0 at the end of the trace. They stay valid until the next
+ * call on reader.
+ */
+long trace_next_run(trace_reader_t *reader, const trace_access_t **run);
+
+/**
+ * @brief From now on, hand out an access that crosses a boundary of 2^b
+ * byte blocks as one access per block it touches, each with the bytes of
+ * its block. Every piece but the first is marked continued, so callers
+ * can still count trace lines. Accesses within one block are not copied.
+ */
+void trace_split_blocks(trace_reader_t *reader, int b);
+
+/**
+ * @brief Release the mapping or buffer and close the trace. Return false if
+ * the trace ended early because it could not be read or decoded.
+ */
+bool trace_close(trace_reader_t *reader);
+
+/** @brief Create a trace for writing, "-" is stdout */
+bool trace_writer_open(trace_writer_t *writer, const char *file_name,
+                       bool binary);
+
+/** @brief Append one access to the trace */
+void trace_write(trace_writer_t *writer, const trace_access_t *access);
+
+/** @brief Append count accesses to the trace, faster than one at a time */
+void trace_write_batch(trace_writer_t *writer, const trace_access_t *accesses,
+                       int count);
+
+/** @brief Flush and close the trace. Return false if any write failed. */
+bool trace_writer_close(trace_writer_t *writer);
+
+#endif /* CACHELAB_TRACE_H */
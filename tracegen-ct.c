@@ -8,6 +8,8 @@
  * all of the accesses together.
  */
 
+#define _POSIX_C_SOURCE 200112L /* for posix_memalign */
+
 #include "cachelab.h"
 #include <assert.h>
 #include <getopt.h>
@@ -19,70 +21,155 @@
 #include <signal.h>
 
 #include "cachelab.h"
+#include "trace.h"
 
 /* Enable / disable tracing */
 extern void __roi_begin();
 extern void __roi_end();
 
-/* Need to make sure A and B start on cache block boundaries */
-static double bigA[MAXN][MAXN] __attribute__((aligned(64)));
-static double bigT[TMPCOUNT] __attribute__((aligned(64)));
-static double bigB[MAXN][MAXN] __attribute__((aligned(64)));
-static double bigAcopy[MAXN][MAXN];
-static double bigBtarg[MAXN][MAXN];
+/* Rows past the end of B that must stay untouched */
+#define GUARD_ROWS 10
+
+/* The sets of the simulated caches repeat every this many bytes */
+#define LAYOUT_SPAN 4096
+
+/*
+ * A, T and B share one block, laid out as the static MAXN x MAXN arrays
+ * used to be: T starts on a span boundary right after A and B right after
+ * T, so every matrix maps onto the same cache sets whatever M and N are.
+ */
+static double *bigA;
+static double *bigT;
+static double *bigB;
+static double *bigAcopy;
+static double *bigBtarg;
 static size_t M;
 static size_t N;
 
+/* Trace file to rewrite in the binary format at exit, NULL if none */
+static const char *binaryTrace = NULL;
+
+/**
+ * @brief Check that B is the transpose of A, A is unchanged and nothing was
+ * written past B.
+ *
+ * The whole matrices are compared with memcmp() first; only a mismatch
+ * walks them to find and report the first differing element.
+ */
 bool validate(int fn, double A[N][M], double Acopy[N][M], double B[M][N],
               double Btarg[M][N]) {
     size_t i, j;
-    size_t xM = M + 10;
+    size_t xM = M + GUARD_ROWS;
     if (xM > MAXN)
         xM = MAXN;
-    for (i = 0; i < M; i++) {
-        for (j = 0; j < N; j++) {
-            if (B[i][j] != Btarg[i][j]) {
-                fprintf(stderr,
-                        "Validation failed on function %d! Expected %.3f but "
-                        "got %.3f at B[%zd][%zd]\n",
-                        fn, Btarg[i][j], B[i][j], i, j);
-                return false;
+    if (memcmp(B, Btarg, M * N * sizeof(double)) != 0) {
+        for (i = 0; i < M; i++) {
+            for (j = 0; j < N; j++) {
+                if (B[i][j] != Btarg[i][j]) {
+                    fprintf(stderr,
+                            "Validation failed on function %d! Expected %.3f "
+                            "but got %.3f at B[%zd][%zd]\n",
+                            fn, Btarg[i][j], B[i][j], i, j);
+                    return false;
+                }
             }
         }
     }
 
     /* Look for changes to A */
-    for (j = 0; j < N; j++) {
-        for (i = 0; i < M; i++) {
-            if (A[j][i] != Acopy[j][i]) {
-                fprintf(
-                    stderr,
-                    "Validation failed on function %d! A[%zd][%zd] corrupted\n",
-                    fn, j, i);
-                return false;
+    if (memcmp(A, Acopy, N * M * sizeof(double)) != 0) {
+        for (j = 0; j < N; j++) {
+            for (i = 0; i < M; i++) {
+                if (A[j][i] != Acopy[j][i]) {
+                    fprintf(stderr,
+                            "Validation failed on function %d! A[%zd][%zd] "
+                            "corrupted\n",
+                            fn, j, i);
+                    return false;
+                }
             }
         }
     }
 
     /* Look for out of bounds writes to B, scanning a few more rows */
-    for (i = M; i < xM; i++)
-        for (j = 0; j < N; j++) {
-            if (B[i][j] != 0) {
-                fprintf(stderr,
-                        "Validation failed on function %d! Out-of-bounds write "
-                        "to B[%zd][%zd]\n",
-                        fn, i, j);
-                return false;
+    const double *guard = &B[M][0];
+    size_t guard_count = (xM - M) * N;
+    bool written = false;
+    for (size_t k = 0; k < guard_count; k++)
+        written |= guard[k] != 0;
+    if (written) {
+        for (i = M; i < xM; i++)
+            for (j = 0; j < N; j++) {
+                if (B[i][j] != 0) {
+                    fprintf(stderr,
+                            "Validation failed on function %d! Out-of-bounds "
+                            "write to B[%zd][%zd]\n",
+                            fn, i, j);
+                    return false;
+                }
             }
-        }
+    }
     return true;
 }
 
+/**
+ * @brief Allocate the matrices for an M x N transpose, with only the parts
+ * that are read before being written initialized.
+ *
+ * @return True if the function succeeded, and false otherwise
+ */
+static bool alloc_matrices(void) {
+    size_t rows = M + GUARD_ROWS;
+    if (rows > MAXN)
+        rows = MAXN;
+
+    size_t a_bytes = M * N * sizeof(double);
+    size_t t_offset = (a_bytes + LAYOUT_SPAN - 1) / LAYOUT_SPAN * LAYOUT_SPAN;
+    size_t b_offset = t_offset + TMPCOUNT * sizeof(double);
+    size_t b_bytes = rows * N * sizeof(double);
+
+    void *block;
+    if (posix_memalign(&block, LAYOUT_SPAN, b_offset + b_bytes) != 0)
+        return false;
+    bigA = block;
+    bigT = (double *)((char *)block + t_offset);
+    bigB = (double *)((char *)block + b_offset);
+
+    /* initMatrix() fills A and the first M rows of B */
+    memset(bigB + M * N, 0, (rows - M) * N * sizeof(double));
+
+    bigAcopy = malloc(a_bytes);
+    bigBtarg = malloc(a_bytes);
+    return bigAcopy != NULL && bigBtarg != NULL;
+}
+
+/**
+ * @brief Write the address ranges of A, T and B as a csim -R regions file
+ *
+ * @return True if the function succeeded, and false otherwise
+ */
+static bool write_regions(const char *file_name) {
+    FILE *fp = fopen(file_name, "w");
+    if (fp == NULL)
+        return false;
+    fprintf(fp, "# %zu x %zu transpose\n", M, N);
+    fprintf(fp, "A %lx %lx\n", (unsigned long)bigA,
+            (unsigned long)(bigA + M * N));
+    fprintf(fp, "T %lx %lx\n", (unsigned long)bigT,
+            (unsigned long)(bigT + TMPCOUNT));
+    fprintf(fp, "B %lx %lx\n", (unsigned long)bigB,
+            (unsigned long)(bigB + M * N));
+    return fclose(fp) == 0;
+}
+
 static void usage(char *cmd) {
-    fprintf(stderr, "Usage: %s [-h] [-M M] [-N N] [-F ID]\n", cmd);
+    fprintf(stderr, "Usage: %s [-hB] [-M M] [-N N] [-F ID] [-R FILE]\n", cmd);
     fprintf(stderr, "  -N N    Set number of rows of A / cols of B\n");
     fprintf(stderr, "  -M M    Set number of cols of A / rows of B\n");
     fprintf(stderr, "  -F ID   Run function number ID\n");
+    fprintf(stderr, "  -B      Write the trace in the binary format\n");
+    fprintf(stderr, "  -R FILE Write the address ranges of A, T and B to FILE, "
+                    "for csim -R\n");
     fprintf(stderr, "\n");
     fprintf(stderr, "The generated trace file is written to default.trace "
                     "by default, but a\n");
@@ -92,9 +179,49 @@ static void usage(char *cmd) {
     fprintf(stderr, "\n");
     fprintf(stderr, "    CONTECH_TRACE=trace.f0 %s -N 32 -M 32 -F 0\n", cmd);
     fprintf(stderr, "\n");
+    fprintf(stderr, "It can also name a pipe, as test-trans does to "
+                    "simulate the trace as it is\n");
+    fprintf(stderr, "generated:\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "    CONTECH_TRACE=/dev/fd/3 %s -N 32 -M 32 -F 0 "
+                    "3>&1 | ./csim -s 5 -E 1 -b 5 -t -\n",
+            cmd);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "-B needs a regular file.\n");
+    fprintf(stderr, "\n");
     exit(0);
 }
 
+/**
+ * @brief Rewrite the finished text trace in the binary format.
+ *
+ * Runs as an exit handler, after the tracing runtime has flushed and closed
+ * the trace file.
+ */
+static void convert_trace(void) {
+    char tmpName[FILENAME_MAX];
+    snprintf(tmpName, sizeof(tmpName), "%s.tmp", binaryTrace);
+
+    trace_reader_t reader;
+    if (!trace_open(&reader, binaryTrace))
+        return;
+    trace_writer_t writer;
+    if (!trace_writer_open(&writer, tmpName, true)) {
+        trace_close(&reader);
+        return;
+    }
+
+    trace_access_t access;
+    while (trace_next(&reader, &access))
+        trace_write(&writer, &access);
+    trace_close(&reader);
+
+    if (!trace_writer_close(&writer) || rename(tmpName, binaryTrace) != 0) {
+        fprintf(stderr, "Error writing binary trace %s\n", binaryTrace);
+        remove(tmpName);
+    }
+}
+
 /**
  * @brief SIGALRM handler
  */
@@ -111,7 +238,8 @@ int entry(int argc, char *argv[]) {
 
     char c;
     int selectedFunc = -1;
-    while ((c = getopt(argc, argv, "hvM:N:F:")) != -1) {
+    const char *regionsFile = NULL;
+    while ((c = getopt(argc, argv, "hvBM:N:F:R:")) != -1) {
         switch (c) {
         case 'M':
             M = (size_t)atoi(optarg);
@@ -124,6 +252,15 @@ int entry(int argc, char *argv[]) {
             break;
         case 'v':
             break;
+        case 'R':
+            regionsFile = optarg;
+            break;
+        case 'B':
+            binaryTrace = getenv("CONTECH_TRACE");
+            if (binaryTrace == NULL)
+                binaryTrace = "default.trace";
+            atexit(convert_trace);
+            break;
         case 'h':
         default:
             usage(argv[0]);
@@ -149,36 +286,47 @@ int entry(int argc, char *argv[]) {
     /*  Register transpose functions */
     registerFunctions();
 
-    /* Clear out matrices */
-    memset(bigA, 0, sizeof(bigA));
-    memset(bigB, 0, sizeof(bigB));
+    if (!alloc_matrices()) {
+        fprintf(stderr, "Error: Unable to allocate %zu x %zu matrices\n", M,
+                N);
+        exit(1);
+    }
+
+    if (regionsFile != NULL && !write_regions(regionsFile)) {
+        fprintf(stderr, "Error: Unable to write regions file %s\n",
+                regionsFile);
+        exit(1);
+    }
 
     /* Fill A with data */
-    initMatrix(M, N, bigA, bigB);
+    initMatrix(M, N, (double(*)[M])bigA, (double(*)[N])bigB);
     /* Make copy of A */
-    memset(bigAcopy, 0, sizeof(bigAcopy));
-    copyMatrix(M, N, bigAcopy, bigA);
+    copyMatrix(M, N, (double(*)[M])bigAcopy, (double(*)[M])bigA);
     /* Generate target version */
-    memset(bigBtarg, 0, sizeof(bigBtarg));
-    correctTrans(M, N, bigA, bigBtarg);
+    correctTrans(M, N, (double(*)[M])bigA, (double(*)[N])bigBtarg);
 
     if (-1 == selectedFunc) {
         /* Invoke registered transpose functions */
         for (i = 0; i < func_counter; i++) {
-            memset(bigT, 0, sizeof(bigT));
+            memset(bigT, 0, TMPCOUNT * sizeof(double));
             __roi_begin();
-            (*func_list[i].func_ptr)(M, N, bigA, bigB, bigT);
+            (*func_list[i].func_ptr)(M, N, (double(*)[M])bigA,
+                                     (double(*)[N])bigB, bigT);
             __roi_end();
-            if (!validate(i, bigA, bigAcopy, bigB, bigBtarg)) {
+            if (!validate(i, (double(*)[M])bigA, (double(*)[M])bigAcopy,
+                          (double(*)[N])bigB, (double(*)[N])bigBtarg)) {
                 return i + 1;
             }
         }
     } else {
-        memset(bigT, 0, sizeof(bigT));
+        memset(bigT, 0, TMPCOUNT * sizeof(double));
         __roi_begin();
-        (*func_list[selectedFunc].func_ptr)(M, N, bigA, bigB, bigT);
+        (*func_list[selectedFunc].func_ptr)(M, N, (double(*)[M])bigA,
+                                            (double(*)[N])bigB, bigT);
         __roi_end();
-        if (!validate(selectedFunc, bigA, bigAcopy, bigB, bigBtarg)) {
+        if (!validate(selectedFunc, (double(*)[M])bigA,
+                      (double(*)[M])bigAcopy, (double(*)[N])bigB,
+                      (double(*)[N])bigBtarg)) {
             return 1;
         }
     }